@@ -0,0 +1,547 @@
+// End-to-end throughput benchmark: full transfers through the virtual cable,
+// swept over file, frame size, baud rate, propagation delay and BER, with one
+// CSV row per transfer. Each row has the measured efficiency next to the
+// theoretical one of stop and wait (the protocol implemented) and of Go-Back-N
+// and Selective Repeat with a window of W frames; a failed transfer leaves
+// them (and its goodput) empty, so that it stays out of the comparison.
+//
+// The cable (bin/cable, next to this program) runs in virtual time by default,
+// so slow links cost no more than fast ones; the transmitter and receiver are
+// child processes using the link layer directly, not the application layer:
+// the frame size swept is the payload of every frame, which the packets the
+// application layer packs into frames (headers, START and END) would not keep.
+//
+// Efficiency S = R / C, with R the payload bits per second of the transfer and
+// C the baud rate. Theory, with F the mean I frame size on the wire (stuffing
+// included, for the actual file), L the mean payload per frame and 10 bits per
+// byte on the wire (8-N-1):
+//   Tf = 10 F / C, a = Tprop / Tf, p = 1 - (1 - BER)^(8 F), e = 8 L / (10 F)
+//   stop and wait       e (1 - p) / (1 + 2a)
+//   Go-Back-N           e (1 - p) / (1 + 2ap)                  if W >= 1 + 2a
+//                       e W (1 - p) / ((1 + 2a)(1 - p + Wp))   otherwise
+//   Selective Repeat    e (1 - p)                              if W >= 1 + 2a
+//                       e W (1 - p) / (1 + 2a)                 otherwise
+//
+// Files are paths or synthetic: random:<size>, zero:<size>, or flags:<size>
+// (every byte a FLAG, the worst case for stuffing).
+
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "link_layer.h"
+#include "perf_counters.h"
+#include "serial_port.h"
+#include "trace.h"
+#include "virtual_clock.h"
+
+#define N_TRIES 3
+#define TIMEOUT 4
+#define DEFAULT_WINDOW 7
+#define MAX_VALUES 32           // Per swept parameter
+#define RUN_TIMEOUT_SEC 600     // Real time allowed per transfer
+#define RX_HEAD_START_USEC 100000 // Receiver attaches first (its wait has no deadline)
+
+static const char *usage =
+    "Usage: %s [options]\n"
+    "  -f <files>        files to send, comma separated (default penguin.gif);\n"
+    "                    random:<size>, zero:<size> and flags:<size> are synthetic\n"
+    "  -F <sizes>        payload bytes per frame (default %d)\n"
+    "  -B <baud rates>   (default 9600)\n"
+    "  -P <delays>       propagation delays, usec (default 0)\n"
+    "  -E <bers>         bit error ratios (default 0)\n"
+    "  -n <runs>         transfers per combination, with different error seeds (default 1)\n"
+    "  -w <frames>       window of the sliding window curves (default %d)\n"
+    "  -o <csv file>     (default standard output)\n"
+    "  -R                real time (the cable runs in virtual time otherwise)\n";
+
+static char tmpDir[] = "/tmp/bench-XXXXXX";
+static char txPort[64];
+static char rxPort[64];
+static char clockPath[64];
+static char controlPath[64];
+static pid_t cable = -1;
+static int controlFd = -1;
+
+// Comma separated list of numbers.
+// Returns the number of values, or -1 if invalid.
+static int parse_list(char *list, double *values)
+{
+    int n = 0;
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *end;
+        if (n == MAX_VALUES) return -1;
+        values[n++] = strtod(item, &end);
+        if (*end != '\0' || values[n - 1] < 0) return -1;
+    }
+    return n;
+}
+
+// Path of a file to send: a synthetic one is created in the temporary
+// directory.
+// Returns NULL on error.
+static char *prepare_file(const char *spec, int index)
+{
+    char kind[16];
+    long size;
+    if (sscanf(spec, "%15[a-z]:%ld", kind, &size) != 2 || size <= 0) {
+        return strdup(spec);
+    }
+    if (strcmp(kind, "random") != 0 && strcmp(kind, "flags") != 0 && strcmp(kind, "zero") != 0) {
+        fprintf(stderr, "Unknown synthetic file %s\n", spec);
+        return NULL;
+    }
+
+    char *path = malloc(sizeof(tmpDir) + 32);
+    sprintf(path, "%s/input%d", tmpDir, index);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    unsigned int seed = 1;
+    for (long i = 0; i < size; i++) {
+        int byte = strcmp(kind, "random") == 0 ? rand_r(&seed) & 0xFF
+                 : strcmp(kind, "flags") == 0 ? FLAG
+                 : 0;
+        fputc(byte, f);
+    }
+    fclose(f);
+    return path;
+}
+
+static long file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return -1;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+// Mean size on the wire of the I frames carrying "path" in frames of
+// "frameSize" payload bytes, and their number.
+static double mean_frame_size(const char *path, int frameSize, long *nFrames)
+{
+    FILE *f = fopen(path, "rb");
+    unsigned char payload[MAX_PAYLOAD_SIZE];
+    unsigned char frame[MAX_FRAME_SIZE];
+    long total = 0;
+    int n;
+    *nFrames = 0;
+    while (f != NULL && (n = fread(payload, 1, frameSize, f)) > 0) {
+        total += buildInformationFrame(payload, n, 0, frame);
+        (*nFrames)++;
+    }
+    if (f != NULL) fclose(f);
+    return *nFrames > 0 ? (double) total / *nFrames : 0;
+}
+
+////////////////////////////////////////////////
+// CABLE
+////////////////////////////////////////////////
+
+// Start the cable, next to this program, with a control socket.
+// Returns -1 on error.
+static int start_cable(const char *self, int virtualTime)
+{
+    char path[512];
+    const char *slash = strrchr(self, '/');
+    snprintf(path, sizeof(path), "%.*scable", slash != NULL ? (int) (slash - self + 1) : 0, self);
+
+    cable = fork();
+    if (cable < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (cable == 0) {
+        char log[sizeof(tmpDir) + 16];
+        sprintf(log, "%s/cable.log", tmpDir);
+        freopen("/dev/null", "r", stdin);
+        freopen(log, "w", stdout);
+        dup2(fileno(stdout), STDERR_FILENO);
+        if (virtualTime) {
+            execl(path, path, "-c", controlPath, "-v", clockPath, txPort, rxPort, NULL);
+        }
+        else {
+            execl(path, path, "-c", controlPath, txPort, rxPort, NULL);
+        }
+        perror(path);
+        _exit(1);
+    }
+
+    // Wait for the control socket
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, controlPath);
+    for (int i = 0; i < 200; i++) {
+        controlFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(controlFd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return 0;
+        }
+        close(controlFd);
+        controlFd = -1;
+        if (waitpid(cable, NULL, WNOHANG) == cable) break;
+        usleep(10000);
+    }
+    fprintf(stderr, "The cable did not start (see its output in %s/cable.log)\n", tmpDir);
+    return -1;
+}
+
+// Run a cable command, once its settings are in place.
+// Returns -1 on error.
+static int cable_command(const char *format, double value)
+{
+    char command[64];
+    char reply[256];
+    int n = snprintf(command, sizeof(command), format, value);
+    if (write(controlFd, command, n) != n || read(controlFd, reply, sizeof(reply)) <= 0) {
+        fprintf(stderr, "Lost the connection to the cable\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_cable(void)
+{
+    if (controlFd >= 0) {
+        write(controlFd, "quit\n", 5);
+        close(controlFd);
+    }
+    if (cable > 0) {
+        waitpid(cable, NULL, 0);
+    }
+}
+
+////////////////////////////////////////////////
+// TRANSFER
+////////////////////////////////////////////////
+
+static LinkLayer parameters(const char *port, LinkLayerRole role, int baudRate)
+{
+    LinkLayer ll = {
+        .role = role,
+        .baudRate = baudRate,
+        .nRetransmissions = N_TRIES,
+        .timeout = TIMEOUT,
+    };
+    strcpy(ll.serialPort, port);
+    return ll;
+}
+
+// Send "path" in frames of "frameSize" bytes, reporting the transfer time
+// on stdout.
+static int transmit(const char *path, int frameSize, int baudRate)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL || llopen(parameters(txPort, LlTx, baudRate)) < 0) {
+        return 1;
+    }
+
+    struct timespec start, end;
+    serialPortTime(&start);
+    unsigned char buf[MAX_PAYLOAD_SIZE];
+    int n;
+    int res = 0;
+    while (res >= 0) {
+        PERF_ENTER(PERF_FILE_READ);
+        n = fread(buf, 1, frameSize, in);
+        PERF_EXIT();
+        if (n <= 0) break;
+        res = llwrite(buf, n);
+    }
+    serialPortTime(&end);
+    printf("Transfer time: %.9f s\n",
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    fclose(in);
+    if (llclose(TRUE) < 0) res = -1;
+    return res < 0;
+}
+
+static int receive(const char *path, int baudRate)
+{
+    FILE *out = fopen(path, "wb");
+    if (out == NULL || llopen(parameters(rxPort, LlRx, baudRate)) < 0) {
+        return 1;
+    }
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    int n;
+    while ((n = llread(packet)) > 0) {
+        PERF_ENTER(PERF_FILE_WRITE);
+        fwrite(packet, 1, n, out);
+        PERF_EXIT();
+        TRACE_EVENT(TRACE_DISK_WRITE, n);
+    }
+    fclose(out);
+    if (llclose(TRUE) < 0) n = -1;
+    return n < 0;
+}
+
+// Run one side in a child process, with its output in "log".
+static pid_t spawn(int isTx, const char *file, int frameSize, int baudRate,
+                   int virtualTime, const char *log)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    alarm(RUN_TIMEOUT_SEC);
+    freopen(log, "w", stdout);
+    dup2(fileno(stdout), STDERR_FILENO);
+    if (virtualTime) {
+        setenv(CLOCK_ENV, clockPath, 1);
+    }
+    exit(isTx ? transmit(file, frameSize, baudRate) : receive(file, baudRate));
+}
+
+struct Result {
+    int ok;
+    double setupMs;
+    double transferSec;
+    double teardownMs;
+    int frames;
+    int retransmissions;
+    int timeouts;
+    int rej;
+};
+
+// Pick the figures out of the transmitter's output.
+static void parse_output(const char *log, struct Result *r)
+{
+    FILE *f = fopen(log, "r");
+    char line[256];
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        sscanf(line, "Connection established in %lf ms", &r->setupMs);
+        sscanf(line, "Transfer time: %lf s", &r->transferSec);
+        sscanf(line, "  - Disconnection: %lf ms", &r->teardownMs);
+        sscanf(line, "  - Information frames sent: %d (%d retransmissions)",
+               &r->frames, &r->retransmissions);
+        sscanf(line, "  - Timeouts: %d", &r->timeouts);
+        sscanf(line, "  - REJ received: %d", &r->rej);
+    }
+    if (f != NULL) fclose(f);
+}
+
+static int same_files(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    int same = fa != NULL && fb != NULL;
+    while (same) {
+        int ca = getc(fa);
+        same = ca == getc(fb);
+        if (ca == EOF) break;
+    }
+    if (fa != NULL) fclose(fa);
+    if (fb != NULL) fclose(fb);
+    return same;
+}
+
+// Transfer "file" once with the cable set up as given.
+// Returns -1 if the cable is gone.
+static int run(const char *file, int frameSize, double baud, double prop, double ber,
+               int seed, int virtualTime, struct Result *r)
+{
+    if (cable_command("baud %.0f\n", baud) < 0 || cable_command("prop %.0f\n", prop) < 0 ||
+        cable_command("ber %g\n", ber) < 0 || cable_command("seed %.0f\n", seed) < 0) {
+        return -1;
+    }
+
+    char received[sizeof(tmpDir) + 16], txLog[sizeof(tmpDir) + 16], rxLog[sizeof(tmpDir) + 16];
+    sprintf(received, "%s/received", tmpDir);
+    sprintf(txLog, "%s/tx.log", tmpDir);
+    sprintf(rxLog, "%s/rx.log", tmpDir);
+
+    pid_t rx = spawn(FALSE, received, frameSize, baud, virtualTime, rxLog);
+    usleep(RX_HEAD_START_USEC);
+    pid_t tx = spawn(TRUE, file, frameSize, baud, virtualTime, txLog);
+    int txStatus, rxStatus;
+    waitpid(tx, &txStatus, 0);
+    waitpid(rx, &rxStatus, 0);
+
+    memset(r, 0, sizeof(*r));
+    parse_output(txLog, r);
+    r->ok = WIFEXITED(txStatus) && WEXITSTATUS(txStatus) == 0 &&
+            WIFEXITED(rxStatus) && WEXITSTATUS(rxStatus) == 0 && same_files(file, received);
+    return 0;
+}
+
+////////////////////////////////////////////////
+// THEORY
+////////////////////////////////////////////////
+
+struct Theory {
+    double stopAndWait;
+    double goBackN;
+    double selectiveRepeat;
+};
+
+static struct Theory theory(double frameBytes, double payloadBytes, double baud,
+                            double propUsec, double ber, int window)
+{
+    double tf = 10 * frameBytes / baud;
+    double a = propUsec / 1e6 / tf;
+    double p = 1 - pow(1 - ber, 8 * frameBytes);
+    double e = 8 * payloadBytes / (10 * frameBytes);
+    int full = window >= 1 + 2 * a;
+
+    struct Theory t;
+    t.stopAndWait = e * (1 - p) / (1 + 2 * a);
+    t.goBackN = full ? e * (1 - p) / (1 + 2 * a * p)
+                     : e * window * (1 - p) / ((1 + 2 * a) * (1 - p + window * p));
+    t.selectiveRepeat = full ? e * (1 - p) : e * window * (1 - p) / (1 + 2 * a);
+    return t;
+}
+
+////////////////////////////////////////////////
+// MAIN
+////////////////////////////////////////////////
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    if (cable > 0) kill(cable, SIGTERM);
+    _exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    char defaultFiles[] = "penguin.gif";
+    char *files = defaultFiles;
+    double frameSizes[MAX_VALUES] = {MAX_PAYLOAD_SIZE};
+    double bauds[MAX_VALUES] = {9600};
+    double props[MAX_VALUES] = {0};
+    double bers[MAX_VALUES] = {0};
+    int nFrameSizes = 1, nBauds = 1, nProps = 1, nBers = 1;
+    int runs = 1;
+    int window = DEFAULT_WINDOW;
+    int virtualTime = TRUE;
+    FILE *csv = stdout;
+
+    int opt;
+    int valid = TRUE;
+    while ((opt = getopt(argc, argv, "f:F:B:P:E:n:w:o:R")) != -1) {
+        switch (opt) {
+            case 'f': files = optarg; break;
+            case 'F': valid = valid && (nFrameSizes = parse_list(optarg, frameSizes)) > 0; break;
+            case 'B': valid = valid && (nBauds = parse_list(optarg, bauds)) > 0; break;
+            case 'P': valid = valid && (nProps = parse_list(optarg, props)) > 0; break;
+            case 'E': valid = valid && (nBers = parse_list(optarg, bers)) > 0; break;
+            case 'n': runs = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'o':
+                csv = fopen(optarg, "w");
+                if (csv == NULL) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            case 'R': virtualTime = FALSE; break;
+            default: valid = FALSE; break;
+        }
+    }
+    for (int i = 0; i < nFrameSizes; i++) {
+        valid = valid && frameSizes[i] >= 1 && frameSizes[i] <= MAX_PAYLOAD_SIZE;
+    }
+    for (int i = 0; i < nBers; i++) {
+        valid = valid && bers[i] < 1;
+    }
+    if (!valid || optind != argc || runs < 1 || window < 1) {
+        printf(usage, argv[0], MAX_PAYLOAD_SIZE, DEFAULT_WINDOW);
+        return 1;
+    }
+
+    if (mkdtemp(tmpDir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    sprintf(txPort, "%s/ttyTx", tmpDir);
+    sprintf(rxPort, "%s/ttyRx", tmpDir);
+    sprintf(clockPath, "%s/clock", tmpDir);
+    sprintf(controlPath, "%s/control", tmpDir);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+    if (start_cable(argv[0], virtualTime) < 0) {
+        stop_cable();
+        return 1;
+    }
+
+    fprintf(csv, "file,bytes,frame_size,baud,prop_us,ber,run,ok,setup_ms,transfer_s,teardown_ms,"
+                 "goodput_bps,S,S_stop_and_wait,S_go_back_n,S_selective_repeat,window,"
+                 "frames,retransmissions,timeouts,rej\n");
+    fflush(csv);
+
+    int failed = 0;
+    int nFiles = 0;
+    for (char *spec = strtok(files, ","); spec != NULL; spec = strtok(NULL, ",")) {
+        char *file = prepare_file(spec, nFiles++);
+        long size = file != NULL ? file_size(file) : -1;
+        if (size < 0) {
+            fprintf(stderr, "Cannot read %s\n", spec);
+            failed++;
+            continue;
+        }
+
+        for (int f = 0; f < nFrameSizes; f++) {
+            long nFrames;
+            double frameBytes = mean_frame_size(file, frameSizes[f], &nFrames);
+            double payloadBytes = nFrames > 0 ? (double) size / nFrames : 0;
+
+            for (int b = 0; b < nBauds; b++)
+            for (int p = 0; p < nProps; p++)
+            for (int e = 0; e < nBers; e++)
+            for (int r = 0; r < runs; r++) {
+                struct Result res;
+                if (run(file, frameSizes[f], bauds[b], props[p], bers[e], r + 1, virtualTime, &res) < 0) {
+                    stop_cable();
+                    return 1;
+                }
+                failed += !res.ok;
+
+                fprintf(csv, "%s,%ld,%.0f,%.0f,%.0f,%g,%d,%d,%.3f,%.6f,%.3f,",
+                        spec, size, frameSizes[f], bauds[b], props[p], bers[e], r + 1, res.ok,
+                        res.setupMs, res.transferSec, res.teardownMs);
+                // A failed transfer has no goodput to compare with the theory
+                if (res.ok && res.transferSec > 0) {
+                    double goodput = size * 8 / res.transferSec;
+                    struct Theory t = theory(frameBytes, payloadBytes, bauds[b], props[p], bers[e], window);
+                    fprintf(csv, "%.0f,%.4f,%.4f,%.4f,%.4f,", goodput, goodput / bauds[b],
+                            t.stopAndWait, t.goBackN, t.selectiveRepeat);
+                } else {
+                    fprintf(csv, ",,,,,");
+                }
+                fprintf(csv, "%d,%d,%d,%d,%d\n", window, res.frames, res.retransmissions,
+                        res.timeouts, res.rej);
+                fflush(csv);
+            }
+        }
+        if (strcmp(file, spec) != 0) unlink(file);
+        free(file);
+    }
+
+    stop_cable();
+    char path[sizeof(tmpDir) + 16];
+    const char *names[] = {"received", "tx.log", "rx.log", "cable.log"};
+    for (int i = 0; i < 4; i++) {
+        sprintf(path, "%s/%s", tmpDir, names[i]);
+        unlink(path);
+    }
+    rmdir(tmpDir);
+    if (csv != stdout) fclose(csv);
+
+    if (failed > 0) fprintf(stderr, "%d transfers failed\n", failed);
+    return failed > 0;
+}
@@ -0,0 +1,260 @@
+// Micro-benchmark of the link layer kernels (frame.c), each timed alone on
+// fixed inputs: random bytes, all FLAG (worst case for stuffing) and real
+// files. Inputs are tiled to INPUT_SIZE bytes and cut into frames of
+// MAX_PAYLOAD_SIZE bytes, as llwrite sends them.
+//
+// Every figure is per payload byte (also for the kernels that see the
+// stuffed bytes), the best of REPETITIONS passes over the input, so that
+// interruptions and frequency ramps do not show, pinned to one CPU. Cycles
+// are read from the time stamp counter (reference cycles, at the nominal
+// frequency), on x86 only; elsewhere the column is 0.
+//
+//   stuff    stuffBytes on each payload
+//   destuff  destuffBytes on each stuffed payload (restored between passes)
+//   bcc2     blockCheck on each payload
+//   build    buildInformationFrame (BCC1, BCC2, stuffing, flags)
+//   parse    parseFrameByte on the frames built, one byte at a time
+//   decode   decodeInformationFrame (destuffing and BCC2 check)
+//
+// Usage: microbench [-o <csv file>] [<file>...]   (default file penguin.gif)
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#else
+#define CYCLES() 0ULL
+#endif
+
+#include "frame.h"
+
+#define INPUT_SIZE (1 << 20)
+#define REPETITIONS 25
+#define N_FRAMES ((INPUT_SIZE + MAX_PAYLOAD_SIZE - 1) / MAX_PAYLOAD_SIZE)
+
+static unsigned char input[INPUT_SIZE];
+static unsigned char stuffed[N_FRAMES][2 * MAX_PAYLOAD_SIZE];
+static int stuffedSize[N_FRAMES];
+static unsigned char frames[N_FRAMES * MAX_FRAME_SIZE];
+static int framesSize;
+static unsigned char work[N_FRAMES][MAX_STUFFED_SIZE];
+static int workSize[N_FRAMES];
+static volatile unsigned long sink; // Keeps results alive
+
+static int payload_size(int frame)
+{
+    int left = INPUT_SIZE - frame * MAX_PAYLOAD_SIZE;
+    return left < MAX_PAYLOAD_SIZE ? left : MAX_PAYLOAD_SIZE;
+}
+
+////////////////////////////////////////////////
+// KERNELS (one pass over the input each)
+////////////////////////////////////////////////
+
+static void run_stuff(void)
+{
+    unsigned long total = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        total += stuffBytes(input + i * MAX_PAYLOAD_SIZE, payload_size(i), stuffed[i]);
+    }
+    sink = total;
+}
+
+static void run_destuff(void)
+{
+    unsigned long total = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        total += destuffBytes(work[i], stuffedSize[i]);
+    }
+    sink = total;
+}
+
+static void run_bcc2(void)
+{
+    unsigned long total = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        total += blockCheck(input + i * MAX_PAYLOAD_SIZE, payload_size(i));
+    }
+    sink = total;
+}
+
+static void run_build(void)
+{
+    int size = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        size += buildInformationFrame(input + i * MAX_PAYLOAD_SIZE, payload_size(i), i & 1, frames + size);
+    }
+    framesSize = size;
+    sink = size;
+}
+
+static void run_parse(void)
+{
+    unsigned char data[MAX_STUFFED_SIZE];
+    FrameParser parser;
+    initFrameParser(&parser, data, sizeof(data));
+    unsigned long total = 0;
+    for (int i = 0; i < framesSize; i++) {
+        if (parseFrameByte(&parser, frames[i])) {
+            total += parser.dataSize;
+        }
+    }
+    sink = total;
+}
+
+static void run_decode(void)
+{
+    unsigned long total = 0;
+    for (int i = 0; i < N_FRAMES; i++) {
+        total += decodeInformationFrame(work[i], workSize[i]);
+    }
+    sink = total;
+}
+
+// Stuffed payloads (for destuff) or payloads and BCC2 (for decode), to be
+// processed in place
+static void restore_stuffed(void)
+{
+    for (int i = 0; i < N_FRAMES; i++) {
+        memcpy(work[i], stuffed[i], stuffedSize[i]);
+    }
+}
+
+static void restore_with_bcc2(void)
+{
+    for (int i = 0; i < N_FRAMES; i++) {
+        const unsigned char *payload = input + i * MAX_PAYLOAD_SIZE;
+        unsigned char bcc2 = blockCheck(payload, payload_size(i));
+        workSize[i] = stuffBytes(payload, payload_size(i), work[i]);
+        workSize[i] += stuffBytes(&bcc2, 1, work[i] + workSize[i]);
+    }
+}
+
+struct Kernel {
+    const char *name;
+    void (*run)(void);
+    void (*prepare)(void); // Untimed, before every pass (NULL if none)
+};
+
+static const struct Kernel kernels[] = {
+    {"stuff", run_stuff, NULL},
+    {"destuff", run_destuff, restore_stuffed},
+    {"bcc2", run_bcc2, NULL},
+    {"build", run_build, NULL},
+    {"parse", run_parse, NULL},
+    {"decode", run_decode, restore_with_bcc2},
+};
+
+////////////////////////////////////////////////
+// MEASUREMENT
+////////////////////////////////////////////////
+
+static double now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Time every kernel on the current input, writing a CSV row each
+static void measure(FILE *out, const char *inputName)
+{
+    // Inputs of the kernels that take the output of others
+    for (int i = 0; i < N_FRAMES; i++) {
+        stuffedSize[i] = stuffBytes(input + i * MAX_PAYLOAD_SIZE, payload_size(i), stuffed[i]);
+    }
+    run_build();
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        double bestNs = 0;
+        unsigned long long bestCycles = 0;
+        for (int r = 0; r <= REPETITIONS; r++) {
+            if (kernels[k].prepare != NULL) kernels[k].prepare();
+            double start = now_ns();
+            unsigned long long startCycles = CYCLES();
+            kernels[k].run();
+            unsigned long long cycles = CYCLES() - startCycles;
+            double ns = now_ns() - start;
+            if (r == 0) continue; // Warm-up
+            if (bestNs == 0 || ns < bestNs) bestNs = ns;
+            if (bestCycles == 0 || cycles < bestCycles) bestCycles = cycles;
+        }
+        fprintf(out, "%s,%s,%d,%.4f,%.4f,%.1f\n", kernels[k].name, inputName, INPUT_SIZE,
+                bestNs / INPUT_SIZE, (double) bestCycles / INPUT_SIZE, INPUT_SIZE / bestNs * 1e3);
+    }
+}
+
+// Fill the input with copies of a file.
+// Returns -1 on error.
+static int load_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t size = fread(input, 1, INPUT_SIZE, f);
+    fclose(f);
+    if (size == 0) {
+        fprintf(stderr, "%s is empty\n", path);
+        return -1;
+    }
+    for (size_t i = size; i < INPUT_SIZE; i++) {
+        input[i] = input[i % size];
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *out = stdout;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        if (opt != 'o') {
+            printf("Usage: %s [-o <csv file>] [<file>...]\n", argv[0]);
+            return 1;
+        }
+        out = fopen(optarg, "w");
+        if (out == NULL) {
+            perror(optarg);
+            return 1;
+        }
+    }
+
+    // Stay on one CPU (warm caches, a single time stamp counter)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+
+    fprintf(out, "kernel,input,bytes,ns_per_byte,cycles_per_byte,mb_per_s\n");
+
+    unsigned int seed = 1;
+    for (int i = 0; i < INPUT_SIZE; i++) {
+        input[i] = rand_r(&seed) & 0xFF;
+    }
+    measure(out, "random");
+
+    memset(input, FLAG, INPUT_SIZE);
+    measure(out, "flags");
+
+    const char *defaultFiles[] = {"penguin.gif"};
+    const char **files = optind < argc ? (const char **) argv + optind : defaultFiles;
+    int nFiles = optind < argc ? argc - optind : 1;
+    for (int i = 0; i < nFiles; i++) {
+        if (load_file(files[i]) < 0) {
+            return 1;
+        }
+        measure(out, files[i]);
+    }
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
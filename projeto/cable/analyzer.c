@@ -0,0 +1,689 @@
+// Offline protocol analyzer for captures of the virtual cable ("log <file>").
+// The bytes sent in each direction are decoded into frames with the receiver
+// state machine of the link layer (frame.h), and the cable's view of each
+// byte tells whether the frame got through. Reported:
+//   - a timeline, one line per frame: type, size, what the cable did to it
+//     (delivered, corrupted, lost) and whether it was sent before
+//   - retransmissions, after a REJ or after a timeout
+//   - idle gaps, when neither direction was sending
+//   - byte stuffing and framing overhead
+//   - effective throughput (new payload delivered intact) over time
+//
+// Usage: analyzer [-q] [-i <interval s>] [-g <gap ms>] <capture>
+//   -q  summary only, no timeline
+//   -i  throughput interval (default 1 s)
+//   -g  shortest idle gap shown in the timeline (default 1 ms)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "frame.h"
+
+#define DEFAULT_INTERVAL_SEC 1.0
+#define DEFAULT_GAP_MSEC 1.0
+
+enum { TX2RX, RX2TX, DIRECTIONS };
+const char *directionNames[DIRECTIONS] = { "Tx->Rx", "Rx->Tx" };
+
+// What the cable did to the bytes of a frame
+enum Outcome { DELIVERED, CORRUPTED, LOST, IN_FLIGHT, OUTCOMES };
+const char *outcomeNames[OUTCOMES] = { "ok", "corrupted", "lost", "in flight" };
+
+enum Retransmission { ORIGINAL, AFTER_TIMEOUT, AFTER_REJ };
+
+// Records of one direction, each kind in capture order (which is time order)
+struct Stream
+{
+    uint64_t *sent;       // Bytes entering the cable
+    size_t nSent;
+    uint64_t *delivered;  // Bytes leaving the cable, or lost while in it
+    size_t nDelivered;
+};
+
+struct Frame
+{
+    int direction;
+    uint64_t start;       // Opening flag entered the cable (nsec)
+    uint64_t end;         // Closing flag entered the cable, plus a byte time
+    unsigned char a;
+    unsigned char c;
+    int wireSize;         // Bytes from the opening to the closing flag
+    int dataSize;         // Stuffed bytes between BCC1 and the closing flag
+    int payloadSize;      // Payload of a valid I frame, -1 otherwise
+    int newPayload;       // Payload delivered for the first time
+    enum Outcome outcome;
+    enum Retransmission retransmission;
+};
+
+struct FrameList
+{
+    struct Frame *frames;
+    size_t count;
+    size_t capacity;
+};
+
+struct DirectionStats
+{
+    int frames;
+    int iFrames;
+    int outcomes[OUTCOMES];
+    int retransmissions[3];   // By enum Retransmission
+    long wireBytes;           // All bytes that entered the cable
+    long frameBytes;          // Bytes inside frames
+    long payloadBytes;        // Payload of valid I frames (retransmissions too)
+    long checkedBytes;        // Their payload and BCC2
+    long stuffedBytes;        // The same, once stuffed
+    long newPayloadBytes;     // Payload delivered for the first time
+    double byteTimeNsec;      // Shortest byte time seen inside a frame
+    double idleNsec;          // Time not sending, between the first and last frames
+    double longestIdleNsec;
+    uint64_t longestIdleAt;
+};
+
+int compare_records(const void *a, const void *b)
+{
+    uint64_t ra = *(const uint64_t *) a;
+    uint64_t rb = *(const uint64_t *) b;
+    return ra < rb ? -1 : ra > rb;
+}
+
+// Sort records only if needed (the cable writes each kind in time order)
+void ensure_sorted(uint64_t *records, size_t count)
+{
+    for (size_t i = 1; i < count; i++)
+    {
+        if (CAPTURE_TIME(records[i]) < CAPTURE_TIME(records[i - 1]))
+        {
+            qsort(records, count, sizeof(uint64_t), compare_records);
+            return;
+        }
+    }
+}
+
+struct Frame *add_frame(struct FrameList *list)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? 2 * list->capacity : 1024;
+        list->frames = realloc(list->frames, list->capacity * sizeof(struct Frame));
+        if (list->frames == NULL)
+        {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    struct Frame *f = &list->frames[list->count++];
+    memset(f, 0, sizeof(*f));
+    return f;
+}
+
+// What the cable did to the bytes with delivery ordinals [first, last), one
+// of which (at least) entered while the cable was off if "lostOnEntry".
+enum Outcome frame_outcome(const struct Stream *s, size_t first, size_t last, int lostOnEntry)
+{
+    if (lostOnEntry)
+    {
+        return LOST;
+    }
+    if (last > s->nDelivered)
+    {
+        return IN_FLIGHT;
+    }
+
+    enum Outcome outcome = DELIVERED;
+    for (size_t i = first; i < last; i++)
+    {
+        uint8_t flags = CAPTURE_FLAGS(s->delivered[i]);
+        if (flags & CAPTURE_CABLE_OFF)
+        {
+            return LOST;
+        }
+        if (flags & CAPTURE_CORRUPTED)
+        {
+            outcome = CORRUPTED;
+        }
+    }
+    return outcome;
+}
+
+// Decode the frames sent in one direction. Every byte entering the cable
+// while it is on leaves it once, in order, so the n-th of them maps to the
+// n-th delivered record.
+void decode_frames(int direction, const struct Stream *s, struct FrameList *list)
+{
+    unsigned char data[MAX_STUFFED_SIZE];
+    FrameParser parser;
+    initFrameParser(&parser, data, sizeof(data));
+
+    size_t start = 0;
+    size_t startOrdinal = 0;
+    size_t ordinal = 0;      // Delivery ordinal of the next byte
+    int lostOnEntry = 0;     // Frame bytes that entered while the cable was off
+
+    for (size_t i = 0; i < s->nSent; i++)
+    {
+        uint64_t record = s->sent[i];
+        int done = parseFrameByte(&parser, CAPTURE_BYTE(record));
+        if (parser.state == FRAME_FLAG_RCV)
+        {
+            start = i;
+            startOrdinal = ordinal;
+            lostOnEntry = 0;
+        }
+        if (CAPTURE_FLAGS(record) & CAPTURE_CABLE_OFF)
+        {
+            lostOnEntry++;
+        }
+        else
+        {
+            ordinal++;
+        }
+        if (!done)
+        {
+            continue;
+        }
+
+        struct Frame *f = add_frame(list);
+        f->direction = direction;
+        f->start = CAPTURE_TIME(s->sent[start]);
+        f->wireSize = i - start + 1;
+        uint64_t last = CAPTURE_TIME(record);
+        f->end = last + (last - f->start) / (f->wireSize - 1);
+        f->a = parser.a;
+        f->c = parser.c;
+        f->dataSize = parser.dataSize;
+        f->payloadSize = -1;
+        if ((f->c == I(0) || f->c == I(1)) && f->dataSize > 0)
+        {
+            f->payloadSize = decodeInformationFrame(data, parser.dataSize);
+        }
+        f->outcome = frame_outcome(s, startOrdinal, ordinal, lostOnEntry);
+    }
+}
+
+// Merge the frames of both directions by start time
+struct FrameList merge_frames(const struct FrameList *a, const struct FrameList *b)
+{
+    struct FrameList merged = { 0 };
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a->count || j < b->count)
+    {
+        int fromA = j == b->count || (i < a->count && a->frames[i].start <= b->frames[j].start);
+        *add_frame(&merged) = fromA ? a->frames[i++] : b->frames[j++];
+    }
+    return merged;
+}
+
+int is_information(unsigned char c)
+{
+    return c == I(0) || c == I(1);
+}
+
+// Find retransmissions and the payload delivered for the first time. An I
+// frame with the same number as the previous one in its direction is sent
+// again, after a REJ if one got through since then, or else after a timeout;
+// so are repeated commands. SET starts a new connection.
+void classify_frames(struct FrameList *list)
+{
+    int lastNs[DIRECTIONS] = { -1, -1 };
+    int lastDeliveredNs[DIRECTIONS] = { -1, -1 };
+    int rejected[DIRECTIONS] = { FALSE, FALSE };
+    unsigned char lastCommand[DIRECTIONS] = { 0, 0 };
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        struct Frame *f = &list->frames[i];
+        int d = f->direction;
+
+        if (is_information(f->c))
+        {
+            int frameNs = f->c == I(1);
+            if (frameNs == lastNs[d])
+            {
+                f->retransmission = rejected[d] ? AFTER_REJ : AFTER_TIMEOUT;
+            }
+            lastNs[d] = frameNs;
+            rejected[d] = FALSE;
+            if (f->outcome == DELIVERED && f->payloadSize >= 0 && frameNs != lastDeliveredNs[d])
+            {
+                f->newPayload = f->payloadSize;
+                lastDeliveredNs[d] = frameNs;
+            }
+        }
+        else if (f->c == REJ(0) || f->c == REJ(1))
+        {
+            if (f->outcome == DELIVERED)
+            {
+                rejected[1 - d] = TRUE;
+            }
+        }
+        else if (f->c == SET || f->c == DISC || (f->c & BAUD_MASK) == BAUD)
+        {
+            if (f->c == lastCommand[d])
+            {
+                f->retransmission = AFTER_TIMEOUT;
+            }
+            lastCommand[d] = f->c;
+            if (f->c == SET)
+            {
+                for (int k = 0; k < DIRECTIONS; k++)
+                {
+                    lastNs[k] = -1;
+                    lastDeliveredNs[k] = -1;
+                    rejected[k] = FALSE;
+                }
+            }
+        }
+    }
+}
+
+void frame_name(const struct Frame *f, char *name, size_t size)
+{
+    if (is_information(f->c))
+    {
+        snprintf(name, size, "I(%d)", f->c == I(1));
+    }
+    else if (f->c == RR(0) || f->c == RR(1))
+    {
+        snprintf(name, size, "RR(%d)", f->c & 1);
+    }
+    else if (f->c == REJ(0) || f->c == REJ(1))
+    {
+        snprintf(name, size, "REJ(%d)", f->c & 1);
+    }
+    else if (f->c == SET)
+    {
+        snprintf(name, size, "SET");
+    }
+    else if (f->c == UA)
+    {
+        snprintf(name, size, "UA");
+    }
+    else if (f->c == DISC)
+    {
+        snprintf(name, size, "DISC");
+    }
+    else if (f->c == PROBE)
+    {
+        snprintf(name, size, "PROBE");
+    }
+    else if ((f->c & BAUD_MASK) == BAUD)
+    {
+        snprintf(name, size, "BAUD(%d)", f->c & ~BAUD_MASK);
+    }
+    else
+    {
+        snprintf(name, size, "0x%02X", f->c);
+    }
+}
+
+void print_timeline(const struct FrameList *list, const uint64_t *commands, size_t nCommands,
+                    double gapNsec)
+{
+    printf("Timeline\n"
+           "     time (s)  dir     frame     bytes  payload  cable      notes\n");
+
+    uint64_t busyUntil = list->count > 0 ? list->frames[0].start : 0;
+    size_t c = 0;
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const struct Frame *f = &list->frames[i];
+        for (; c < nCommands && CAPTURE_TIME(commands[c]) <= f->start; c++)
+        {
+            printf("%13.6f  cable %s\n", CAPTURE_TIME(commands[c]) / 1e9,
+                   CAPTURE_BYTE(commands[c]) ? "on" : "off");
+        }
+        if (f->start > busyUntil && f->start - busyUntil >= gapNsec)
+        {
+            printf("%13.6f  idle %.3f ms\n", busyUntil / 1e9, (f->start - busyUntil) / 1e6);
+        }
+        if (f->end > busyUntil)
+        {
+            busyUntil = f->end;
+        }
+
+        char name[16];
+        frame_name(f, name, sizeof(name));
+        char payload[16] = "";
+        if (is_information(f->c))
+        {
+            if (f->payloadSize >= 0)
+            {
+                snprintf(payload, sizeof(payload), "%d", f->payloadSize);
+            }
+            else
+            {
+                snprintf(payload, sizeof(payload), "bad");
+            }
+        }
+        const char *notes = f->retransmission == AFTER_REJ ? "retransmission (REJ)"
+                          : f->retransmission == AFTER_TIMEOUT ? "retransmission (timeout)"
+                          : "";
+        printf("%13.6f  %s  %-8s %6d  %7s  %-*s%s\n", f->start / 1e9,
+               directionNames[f->direction], name, f->wireSize, payload,
+               *notes ? 11 : 0, outcomeNames[f->outcome], notes);
+    }
+    for (; c < nCommands; c++)
+    {
+        printf("%13.6f  cable %s\n", CAPTURE_TIME(commands[c]) / 1e9,
+               CAPTURE_BYTE(commands[c]) ? "on" : "off");
+    }
+    printf("\n");
+}
+
+// Effective throughput per interval: bytes entering the cable in each
+// direction, and new payload delivered (at the time its frame ended).
+void print_throughput(const struct Stream *streams, const struct FrameList *list,
+                      uint64_t duration, double intervalNsec)
+{
+    size_t nIntervals = (size_t) (duration / intervalNsec) + 1;
+    long *wire[DIRECTIONS];
+    long *goodput = calloc(nIntervals, sizeof(long));
+    int *retransmissions = calloc(nIntervals, sizeof(int));
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        wire[d] = calloc(nIntervals, sizeof(long));
+    }
+    if (goodput == NULL || retransmissions == NULL || wire[TX2RX] == NULL || wire[RX2TX] == NULL)
+    {
+        printf("Out of memory\n");
+        exit(1);
+    }
+
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        for (size_t i = 0; i < streams[d].nSent; i++)
+        {
+            size_t k = (size_t) (CAPTURE_TIME(streams[d].sent[i]) / intervalNsec);
+            wire[d][k < nIntervals ? k : nIntervals - 1]++;
+        }
+    }
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const struct Frame *f = &list->frames[i];
+        size_t k = (size_t) (f->end / intervalNsec);
+        k = k < nIntervals ? k : nIntervals - 1;
+        goodput[k] += f->newPayload;
+        retransmissions[k] += f->retransmission != ORIGINAL;
+    }
+
+    double seconds = intervalNsec / 1e9;
+    printf("Throughput (bytes/s, %.3f s intervals)\n"
+           "     time (s)  Tx->Rx wire  goodput  Rx->Tx wire  retransmissions\n", seconds);
+    for (size_t k = 0; k < nIntervals; k++)
+    {
+        printf("%13.3f  %11.0f  %7.0f  %11.0f  %15d\n", k * seconds,
+               wire[TX2RX][k] / seconds, goodput[k] / seconds, wire[RX2TX][k] / seconds,
+               retransmissions[k]);
+    }
+    printf("\n");
+
+    free(goodput);
+    free(retransmissions);
+    free(wire[TX2RX]);
+    free(wire[RX2TX]);
+}
+
+// Add up the frames of each direction, and the time each direction (and
+// the whole link) spent idle between its first and last frames.
+void collect_stats(const struct Stream *streams, const struct FrameList *list,
+                   struct DirectionStats *stats, double *linkIdleNsec, double *longestLinkIdleNsec)
+{
+    uint64_t busyUntil[DIRECTIONS] = { 0, 0 };
+    int started[DIRECTIONS] = { FALSE, FALSE };
+    uint64_t linkBusyUntil = list->count > 0 ? list->frames[0].start : 0;
+    *linkIdleNsec = 0;
+    *longestLinkIdleNsec = 0;
+
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        memset(&stats[d], 0, sizeof(stats[d]));
+        stats[d].wireBytes = streams[d].nSent;
+    }
+
+    for (size_t i = 0; i < list->count; i++)
+    {
+        const struct Frame *f = &list->frames[i];
+        struct DirectionStats *s = &stats[f->direction];
+        s->frames++;
+        s->outcomes[f->outcome]++;
+        s->retransmissions[f->retransmission]++;
+        s->frameBytes += f->wireSize;
+        s->newPayloadBytes += f->newPayload;
+        if (is_information(f->c))
+        {
+            s->iFrames++;
+            if (f->payloadSize >= 0)
+            {
+                s->payloadBytes += f->payloadSize;
+                s->checkedBytes += f->payloadSize + 1;
+                s->stuffedBytes += f->dataSize;
+            }
+        }
+
+        double byteTime = (double) (f->end - f->start) / f->wireSize;
+        if (s->byteTimeNsec == 0 || byteTime < s->byteTimeNsec)
+        {
+            s->byteTimeNsec = byteTime;
+        }
+
+        uint64_t *until = &busyUntil[f->direction];
+        if (started[f->direction] && f->start > *until)
+        {
+            double gap = f->start - *until;
+            s->idleNsec += gap;
+            if (gap > s->longestIdleNsec)
+            {
+                s->longestIdleNsec = gap;
+                s->longestIdleAt = *until;
+            }
+        }
+        started[f->direction] = TRUE;
+        if (f->end > *until)
+        {
+            *until = f->end;
+        }
+
+        if (f->start > linkBusyUntil)
+        {
+            double gap = f->start - linkBusyUntil;
+            *linkIdleNsec += gap;
+            if (gap > *longestLinkIdleNsec)
+            {
+                *longestLinkIdleNsec = gap;
+            }
+        }
+        if (f->end > linkBusyUntil)
+        {
+            linkBusyUntil = f->end;
+        }
+    }
+}
+
+void print_summary(const struct DirectionStats *stats, double linkIdleNsec,
+                   double longestLinkIdleNsec, uint64_t duration)
+{
+    printf("Summary (%.6f s captured)\n", duration / 1e9);
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        const struct DirectionStats *s = &stats[d];
+        printf("%s\n"
+               "  - Frames: %d (%d I frames), %d ok, %d corrupted, %d lost, %d in flight\n"
+               "  - Retransmissions: %d after REJ, %d after timeout\n"
+               "  - Bytes: %ld on the wire (%ld in frames), %ld payload sent, %ld new payload delivered\n"
+               "  - Stuffing overhead: %.2f%% of payload and BCC2; framing efficiency %.2f%%\n"
+               "  - Byte time: %.3f us (%.0f baud)\n"
+               "  - Idle: %.3f ms between frames, longest %.3f ms at %.6f s\n",
+               directionNames[d],
+               s->frames, s->iFrames, s->outcomes[DELIVERED], s->outcomes[CORRUPTED],
+               s->outcomes[LOST], s->outcomes[IN_FLIGHT],
+               s->retransmissions[AFTER_REJ], s->retransmissions[AFTER_TIMEOUT],
+               s->wireBytes, s->frameBytes, s->payloadBytes, s->newPayloadBytes,
+               s->checkedBytes > 0 ? 100.0 * (s->stuffedBytes - s->checkedBytes) / s->checkedBytes : 0,
+               s->wireBytes > 0 ? 100.0 * s->newPayloadBytes / s->wireBytes : 0,
+               s->byteTimeNsec / 1e3, s->byteTimeNsec > 0 ? 10e9 / s->byteTimeNsec : 0,
+               s->idleNsec / 1e6, s->longestIdleNsec / 1e6, s->longestIdleAt / 1e9);
+    }
+    printf("Link idle (neither direction sending): %.3f ms, longest %.3f ms\n",
+           linkIdleNsec / 1e6, longestLinkIdleNsec / 1e6);
+    if (duration > 0)
+    {
+        printf("Effective throughput: %.0f bytes/s\n",
+               stats[TX2RX].newPayloadBytes / (duration / 1e9));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int timeline = TRUE;
+    double intervalNsec = DEFAULT_INTERVAL_SEC * 1e9;
+    double gapNsec = DEFAULT_GAP_MSEC * 1e6;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qi:g:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            timeline = FALSE;
+            break;
+        case 'i':
+            intervalNsec = atof(optarg) * 1e9;
+            break;
+        case 'g':
+            gapNsec = atof(optarg) * 1e6;
+            break;
+        default:
+            intervalNsec = 0;
+            break;
+        }
+    }
+    if (optind != argc - 1 || intervalNsec <= 0 || gapNsec < 0)
+    {
+        printf("Usage: %s [-q] [-i <interval s>] [-g <gap ms>] <capture>\n"
+               "  -q  summary only, no timeline\n"
+               "  -i  throughput interval (default %.0f s)\n"
+               "  -g  shortest idle gap shown in the timeline (default %.0f ms)\n",
+               argv[0], DEFAULT_INTERVAL_SEC, DEFAULT_GAP_MSEC);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+    {
+        printf("%s is not a cable capture\n", path);
+        return 1;
+    }
+
+    // Load all the records
+    size_t count = 0;
+    size_t capacity = 1 << 16;
+    uint64_t *records = malloc(capacity * sizeof(uint64_t));
+    size_t n;
+    while (records != NULL &&
+           (n = fread(records + count, sizeof(uint64_t), capacity - count, in)) > 0)
+    {
+        count += n;
+        if (count == capacity)
+        {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(uint64_t));
+        }
+    }
+    fclose(in);
+    if (records == NULL)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // Split them by direction and kind, keeping their order
+    struct Stream streams[DIRECTIONS] = { { 0 } };
+    size_t nCommands = 0;
+    uint64_t duration = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t flags = CAPTURE_FLAGS(records[i]);
+        struct Stream *s = &streams[flags & CAPTURE_RX2TX ? RX2TX : TX2RX];
+        if (flags & CAPTURE_COMMAND) nCommands++;
+        else if (flags & CAPTURE_DELIVERED) s->nDelivered++;
+        else s->nSent++;
+        if (CAPTURE_TIME(records[i]) > duration)
+        {
+            duration = CAPTURE_TIME(records[i]);
+        }
+    }
+    uint64_t *commands = malloc((nCommands + 1) * sizeof(uint64_t));
+    int allocated = commands != NULL;
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        streams[d].sent = malloc((streams[d].nSent + 1) * sizeof(uint64_t));
+        streams[d].delivered = malloc((streams[d].nDelivered + 1) * sizeof(uint64_t));
+        allocated = allocated && streams[d].sent != NULL && streams[d].delivered != NULL;
+        streams[d].nSent = 0;
+        streams[d].nDelivered = 0;
+    }
+    if (!allocated)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+    nCommands = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t flags = CAPTURE_FLAGS(records[i]);
+        struct Stream *s = &streams[flags & CAPTURE_RX2TX ? RX2TX : TX2RX];
+        if (flags & CAPTURE_COMMAND) commands[nCommands++] = records[i];
+        else if (flags & CAPTURE_DELIVERED) s->delivered[s->nDelivered++] = records[i];
+        else s->sent[s->nSent++] = records[i];
+    }
+    free(records);
+    ensure_sorted(commands, nCommands);
+
+    struct FrameList frames[DIRECTIONS] = { { 0 } };
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        ensure_sorted(streams[d].sent, streams[d].nSent);
+        ensure_sorted(streams[d].delivered, streams[d].nDelivered);
+        decode_frames(d, &streams[d], &frames[d]);
+    }
+    struct FrameList all = merge_frames(&frames[TX2RX], &frames[RX2TX]);
+    classify_frames(&all);
+
+    printf("%s: %zu records, %zu frames\n\n", path, count, all.count);
+    if (timeline)
+    {
+        print_timeline(&all, commands, nCommands, gapNsec);
+    }
+    print_throughput(streams, &all, duration, intervalNsec);
+
+    struct DirectionStats stats[DIRECTIONS];
+    double linkIdleNsec;
+    double longestLinkIdleNsec;
+    collect_stats(streams, &all, stats, &linkIdleNsec, &longestLinkIdleNsec);
+    print_summary(stats, linkIdleNsec, longestLinkIdleNsec, duration);
+
+    for (int d = 0; d < DIRECTIONS; d++)
+    {
+        free(streams[d].sent);
+        free(streams[d].delivered);
+        free(frames[d].frames);
+    }
+    free(all.frames);
+    free(commands);
+    return 0;
+}
@@ -1,558 +1,2060 @@
 // Virtual cable program to test serial port.
-// Creates a pair of virtual Tx / Rx serial ports using "socat".
+// Creates pairs of virtual Tx / Rx serial ports (pseudo-terminals), each
+// pair joined by its own emulated cable.
+//
+// Usage: cable [-n <pairs>] [<tx port> <rx port>]...
+//   The ports are published as symbolic links to the pseudo-terminals, at
+//   /dev/ttyS10 and /dev/ttyS11 by default (writing to /dev needs root);
+//   with -n, pair i uses /dev/ttyS<10+2i> and /dev/ttyS<11+2i>.
 //
 // Author: Manuel Ricardo [mricardo@fe.up.pt]
 // Modified by: Eduardo Nuno Almeida [enalmeida@fe.up.pt]
 // Modified by: Rui Prior [rcprior@fc.up.pt]
 
+#define _GNU_SOURCE // ptsname_r, accept4
+
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
-#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
-#define TXDEV "/dev/ttyS10"
-#define RXDEV "/dev/ttyS11"
-// Baudrate settings are defined in <asm/termbits.h>, which is
-// included by <termios.h>
-#define BAUDRATE B9600         // For struct termios
+#include "capture.h"
+#include "virtual_clock.h"
+
+#define TXDEV "/dev/ttyS10"          // Default Tx port
+#define RXDEV "/dev/ttyS11"          // Default Rx port
+#define FIRST_TTY 10                 // Number of the default Tx port
+#define MAX_PAIRS 64
 #define DEFAULT_BAUDRATE 9600  // For the delaying transmissions
+#define MIN_BAUDRATE 1200
+#define MAX_BAUDRATE 4000000
 #define _POSIX_SOURCE 1        // POSIX compliant source
 #define FALSE 0
 #define TRUE 1
 
 #define BUF_SIZE 2048
 
-// Current running parameters
+// Each direction of every pair runs on its own thread, which sleeps in epoll
+// until its input port has bytes, a byte in flight is due (timerfd) or the
+// settings change (eventfd). Bytes enter a direction in batches while its
+// wire backlog (bytes not yet serialized) is below BUCKET_TICKS ticks, like a
+// token bucket; each byte is then delivered after its own serialization slot
+// plus the propagation delay. The main thread only reads commands.
+#define TICK_NSEC 1000000   // Batching period while a port is throttled
+#define BUCKET_TICKS 4      // Wire backlog accepted, in ticks
+#define MAX_BATCH 4096      // Bytes moved per wakeup, at most
+
+// The capture log is written by a background thread, so that the channels
+// only store a 64-bit record per byte in a lock-free ring. Each producer
+// (the two channels and the command handler) has its own single-producer,
+// single-consumer ring. Records are dropped if the writer falls behind.
+#define CAPTURE_RING_SIZE (1 << 18)  // Records per ring; a power of 2
+#define CAPTURE_FLUSH_NSEC 10000000  // Writer period
+
+enum { CAPTURE_TX2RX_RING, CAPTURE_RX2TX_RING, CAPTURE_COMMAND_RING, CAPTURE_RINGS };
+
+struct CaptureRing {
+    uint64_t *records;
+    atomic_ulong head;              // Next record to write to the file
+    atomic_ulong tail;              // Next free slot
+    unsigned long dropped;          // Records lost to a full ring
+};
+
+struct Capture {
+    FILE *file;
+    long long start;                // Start of the capture (nsec)
+    struct CaptureRing rings[CAPTURE_RINGS];
+    atomic_int stop;                // Set to flush the rings and end the writer
+    pthread_t writer;
+};
+
+// Bit error parameters: a BER, or bursts following the Gilbert-Elliott model
+// (a good and a bad state, each with its own BER, lasting a geometric number
+// of bits with the given mean).
+struct ErrorParams {
+    double ber[2];         // BER in the good and bad states
+    double meanBits[2];    // Mean length of each state in bits (0: no bursts)
+    uint64_t seed;         // Random number generator seed
+    unsigned int reseeds;  // Seed commands so far, each restarting the numbers
+};
+
+// Error engine of one direction. Rather than drawing a random number per
+// byte, the gap to the next wrong bit (and to the next state change) is
+// drawn from a geometric distribution, so clean bytes only decrement a
+// counter; a byte may get several wrong bits.
+struct ErrorModel {
+    uint64_t rng[4];       // xoshiro256** state
+    int state;             // 0 good, 1 bad
+    long long stateBits;   // Bits before the next state change
+    long long errorBits;   // Clean bits before the next wrong bit
+};
+
+// Traffic counters of one direction, updated by its thread and read by the
+// command handler
+struct ChannelStats {
+    atomic_ullong forwarded;   // Bytes delivered
+    atomic_ullong corrupted;   // Bytes delivered with errors
+    atomic_ullong dropped;     // Bytes lost while the cable was off
+    atomic_long queued;        // Bytes in flight (ring occupancy)
+    atomic_llong lateSum;      // Timer wakeup lateness (nsec)...
+    atomic_llong lateMax;
+    atomic_llong lateCount;    // ...and wakeups measured
+};
+
+struct Parameters;
+
+// One direction of a cable
+struct Channel {
+    struct Parameters *pair;  // Cable the direction belongs to
+    pthread_t thread;
+    int wakeFd;            // Signalled when the settings change
+    atomic_uint applied;   // Settings generation applied
+    int fdIn;              // Emulator port the bytes are read from
+    int fdOut;             // Emulator port the bytes are delivered to
+    int direction;         // CAPTURE_RX2TX or 0, for the capture records
+    int captureRing;       // Capture ring of this direction
+    long byteDelay;        // Settings in use (copied from the pair)
+    unsigned long propDelay;
+    struct Capture *capture;
+    struct ErrorParams errorParams;   // Error settings in use
+    struct ErrorModel errors;
+    struct ChannelStats stats;
+    int pending;           // Input may have bytes waiting to be read
+    int polled;            // Input watched by epoll (not throttled)
+    long long resume;      // When to read the throttled input again (nsec)
+    long long wireFree;    // End of the last serialization slot used (nsec)
+    unsigned char *bytes;  // Propagation ring: bytes in flight...
+    long long *due;        // ...and when each one reaches the other end (nsec)
+    long long lastDue;     // Delivery time of the previous byte (nsec)
+    long long bytesIn;     // Bytes read from the input (for the virtual clock)
+    unsigned char unsent[MAX_BATCH];  // Bytes due that the output port did not take...
+    int nUnsent;
+    long long retry;       // ...and when to write them again (nsec)
+    long head;             // Index of the oldest byte in flight
+    long count;            // Bytes in flight
+    long size;             // Ring capacity
+    unsigned long long shown[2];  // Bytes forwarded at the last stats report
+};
+
+// Current running parameters of one cable (pair of ports), shared by the
+// command handler and the channel threads. Changes to the byte delay, propagation
+// delay, errors and capture are announced with update_channels().
 struct Parameters {
-    int cableOn;
-    double byteER;   // Byte error rate
-    struct timespec byteDelay;
-    unsigned long propDelay;   // Desired propagation delay in usec
-    int bufSize;  // Dimensioned to enforce the propagation delay
-    char *tx2rx;
-    char *tx2rxValid;  // TRUE if corresponding entry holds a byte
-    long tx2rxIdx;     // Input index for the tx2rx buffer
-    char *rx2tx;
-    char *rx2txValid;  // TRUE if corresponding entry holds a byte
-    long rx2txIdx;     // Input index for the tx2rx buffer
-    FILE *logfile;
+    int index;               // Pair number
+    atomic_int cableOn;
+    struct ErrorParams errors;  // Written only before update_channels()
+    atomic_ulong baudRate;   // Emulated baud rate...
+    atomic_long byteDelay;   // ...and byte time in nsec (10 bits per byte)
+    atomic_ulong propDelay;  // Desired propagation delay in usec
+    struct Capture *_Atomic capture;  // NULL if not logging
+    int running;             // Channels run (in virtual time, once both
+                             // ports have had a program attached)
+    long long shownTime[2];  // Time of the last stats report (nsec)
+    struct Channel tx2rx;
+    struct Channel rx2tx;
 };
 
-struct Parameters par = {
-    .cableOn = TRUE,
-    .byteER = 0.0,
-    .propDelay = 0,
-    .tx2rx = NULL,
-    .tx2rxValid = NULL,
-    .rx2tx = NULL,
-    .rx2txValid = NULL,
-    .logfile = NULL};
+struct Parameters *pairs = NULL;
+int nPairs = 0;
 
-// Returns: serial port file descriptor (fd).
-int openSerialPort(const char *serialPort, struct termios *oldtio, struct termios *newtio)
-{
-    int fd = open(serialPort, O_RDWR | O_NONBLOCK | O_NOCTTY);
+// Stats reports, each with its own snapshot of the traffic (Channel.shown)
+enum { STATS_COMMAND, STATS_SUMMARY };
 
+// Settings changes announced to the channel threads
+struct {
+    atomic_uint generation;  // Settings generation announced
+    atomic_int stop;         // The channel threads must end
+} scheduler;
+
+// Commands read from stdin or a control socket client, line by line
+#define MAX_CLIENTS 8
+
+struct CommandSource {
+    int fd;
+    char buf[BUF_SIZE];     // Incomplete line received
+    int len;
+};
+
+// Scenario: commands to run at given times since the cable started
+struct ScenarioStep {
+    long long time;         // nsec
+    char *command;
+};
+
+struct {
+    struct ScenarioStep *steps;
+    int count;
+} scenario = { NULL, 0 };
+
+const char *controlPath = NULL;  // Control socket, to remove on exit
+
+// Virtual time (-v <socket>): the cable keeps a simulated clock for the
+// programs attached to it through the clock socket (see virtual_clock.h),
+// and moves it to the next event whenever all of them are blocked
+#define VIRTUAL_START 1000000000LL  // Virtual time when the cable starts (nsec)
+
+struct ClockClient {
+    int fd;                 // -1 if unused
+    int port;               // Index in ports[] (-1 until attached)
+    int waiting;            // Blocked, until woken up
+    long long deadline;     // Wakeup time (nsec, -1 if none)
+    long long written;      // Bytes written to and read from the port
+    long long read;         // by the program, as of the wait
+    long long inBase;       // Counters of the channels when the program
+    unsigned long long outBase;  // attached
+};
+
+int virtualMode = FALSE;
+long long virtualNow = VIRTUAL_START;
+const char *clockPath = NULL;    // Clock socket, to remove on exit
+struct ClockClient *clockClients = NULL;  // One per port
+
+// Emulated serial ports: the symlinks published and the pseudo-terminals
+// they point to, to remove the links on exit only if they are still ours
+struct Port {
+    const char *link;
+    char pts[64];
+    int fd;                 // Master side, used by the cable
+    int slaveFd;            // Slave side, kept open
+    int attached;           // A program attached to the virtual clock
+};
+
+struct Port *ports = NULL;  // Tx and Rx port of each pair, in turn
+int nPorts = 0;
+
+
+// Create a pseudo-terminal for an emulated serial port, published as a
+// symlink at port->link. The cable uses the master side (port->fd); the
+// slave stays open in port->slaveFd, so that the master does not hang up
+// while no application has the port open.
+// Returns: master file descriptor (fd), or -1 on error.
+int openPort(struct Port *port)
+{
+    int *slaveFd = &port->slaveFd;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd < 0)
         return -1;
 
-    // Save current port settings
-    if (tcgetattr(fd, oldtio) == -1)
+    if (grantpt(fd) != 0 || unlockpt(fd) != 0 ||
+        ptsname_r(fd, port->pts, sizeof(port->pts)) != 0)
+    {
+        close(fd);
         return -1;
+    }
 
-    memset(newtio, 0, sizeof(*newtio));
-    newtio->c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
-    newtio->c_iflag = IGNPAR;
-    newtio->c_oflag = 0;
-    newtio->c_lflag = 0;
-    newtio->c_cc[VTIME] = 0; // Inter-character timer unused (polling mode)
-    newtio->c_cc[VMIN] = 0;  // Read without blocking
-    tcflush(fd, TCIOFLUSH);
+    *slaveFd = open(port->pts, O_RDWR | O_NOCTTY);
+    if (*slaveFd < 0)
+    {
+        close(fd);
+        return -1;
+    }
 
-    if (tcsetattr(fd, TCSANOW, newtio) == -1)
+    // Raw 8-bit data, as written by the applications
+    struct termios tio;
+    tcgetattr(*slaveFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slaveFd, TCSANOW, &tio);
+    fchmod(*slaveFd, 0666);
+
+    // Replace a stale link (left by a cable that was killed), but not one to
+    // a port in use
+    struct stat st;
+    if (lstat(port->link, &st) == 0)
+    {
+        if (!S_ISLNK(st.st_mode) || stat(port->link, &st) == 0)
+        {
+            fprintf(stderr, "%s exists and is in use\n", port->link);
+            close(*slaveFd);
+            close(fd);
+            return -1;
+        }
+        unlink(port->link);
+    }
+    if (symlink(port->pts, port->link) != 0)
+    {
+        close(*slaveFd);
+        close(fd);
         return -1;
+    }
 
+    port->fd = fd;
     return fd;
 }
 
 
-// Add noise to a buffer, by flipping the byte in the "errorIndex" position.
-void addNoiseToBuffer(unsigned char *buf, size_t errorIndex)
+// Remove the symlink of a port, if it still points to this cable.
+void closePort(struct Port *port)
+{
+    char target[sizeof(port->pts)];
+    ssize_t n = readlink(port->link, target, sizeof(target) - 1);
+    if (n > 0)
+    {
+        target[n] = '\0';
+        if (strcmp(target, port->pts) == 0)
+        {
+            unlink(port->link);
+        }
+    }
+}
+
+
+// Remove the symlinks (and control socket) when terminated by a signal.
+void onSignal(int sig)
 {
-    buf[errorIndex] ^= 0xFF;
+    (void) sig;
+
+    for (int i = 0; i < nPorts; i++)
+    {
+        closePort(&ports[i]);
+    }
+    if (controlPath != NULL)
+    {
+        unlink(controlPath);
+    }
+    if (clockPath != NULL)
+    {
+        unlink(clockPath);
+    }
+    _exit(1);
 }
 
 
-// Initialize the ring buffers that implement the propagation delay
+// Size the ring buffer that implements the propagation delay of a channel
+// for the bytes that can be in flight. Bytes already in flight are kept, in
+// order and with their delivery times: a byte sent after a change of delay
+// is never delivered before the ones sent earlier.
 // Returns 0 on success, -1 on failure
-int init_ring_buffers(void)
+int init_ring_buffer(struct Channel *ch)
 {
-    long nsecPropDelay = 1000 * par.propDelay;
-    long bytesInFlight = nsecPropDelay / par.byteDelay.tv_nsec;
-    // Round instead of truncating
-    if (nsecPropDelay % par.byteDelay.tv_nsec > par.byteDelay.tv_nsec / 2)
+    long nsecPropDelay = 1000 * ch->propDelay;
+    long bytesInFlight = nsecPropDelay / ch->byteDelay + 1;
+    long size = bytesInFlight + BUCKET_TICKS * TICK_NSEC / ch->byteDelay + MAX_BATCH;
+    if (size < ch->count + MAX_BATCH)
     {
-        ++bytesInFlight;
+        size = ch->count + MAX_BATCH;
     }
-    long actualPropDelay = bytesInFlight * par.byteDelay.tv_nsec / 1000; // usec
-    par.bufSize = bytesInFlight + 1;
-    par.tx2rx = realloc(par.tx2rx, par.bufSize);
-    par.tx2rxValid = realloc(par.tx2rxValid, par.bufSize);
-    par.rx2tx = realloc(par.rx2tx, par.bufSize);
-    par.rx2txValid = realloc(par.rx2txValid, par.bufSize);
-    if (par.tx2rx == NULL || par.tx2rxValid == NULL || par.rx2tx == NULL || par.rx2txValid == NULL)
+
+    unsigned char *bytes = malloc(size);
+    long long *due = malloc(size * sizeof(long long));
+    if (bytes == NULL || due == NULL)
     {
+        free(bytes);
+        free(due);
         return -1;
     }
-    bzero(par.tx2rxValid, par.bufSize);
-    bzero(par.rx2txValid, par.bufSize);
-    par.tx2rxIdx = 0;
-    par.rx2txIdx = 0;
-    printf("PROPAGATION DELAY SET TO %ld usec (DESIRED = %lu usec)\n", actualPropDelay, par.propDelay);
+
+    // Move the bytes in flight to the start of the new ring
+    for (long i = 0; i < ch->count; i++)
+    {
+        long j = (ch->head + i) % ch->size;
+        bytes[i] = ch->bytes[j];
+        due[i] = ch->due[j];
+    }
+    free(ch->bytes);
+    free(ch->due);
+    ch->bytes = bytes;
+    ch->due = due;
+    ch->size = size;
+    ch->head = 0;
     return 0;
 }
 
 
-// Set the byte delay corresponding to the selected baud rate
-void set_baud_rate(unsigned long baud)
+// Set the byte delay of a pair corresponding to the selected baud rate
+void set_baud_rate(struct Parameters *p, unsigned long baud)
 {
     // 10 bit times per byte; delay in nanoseconds
-    double delay = 1.0e10 / baud;
-    par.byteDelay.tv_sec = 0;
-    par.byteDelay.tv_nsec = (long) delay;
-    printf("BAUD RATE: %lu\n", baud);
-    init_ring_buffers();
+    atomic_store(&p->baudRate, baud);
+    atomic_store(&p->byteDelay, (long) (1.0e10 / baud));
+}
+
+
+// Current time in nsec
+long long now_nsec(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+// Current time of the cable: the virtual time, in virtual time mode (nsec)
+long long cable_now(void)
+{
+    return virtualMode ? virtualNow : now_nsec();
+}
+
+
+void apply_all_settings(void);
+
+
+// Make the channel threads apply the current byte delay, propagation delay,
+// errors and capture of their pair, and the stop flag, and wait until they
+// have.
+void update_channels(void)
+{
+    unsigned int generation = atomic_fetch_add(&scheduler.generation, 1) + 1;
+    if (virtualMode)
+    {
+        // No channel threads: the event loop runs the channels itself
+        apply_all_settings();
+        return;
+    }
+
+    uint64_t one = 1;
+    for (int i = 0; i < 2 * nPairs; i++)
+    {
+        struct Channel *ch = i % 2 == 0 ? &pairs[i / 2].tx2rx : &pairs[i / 2].rx2tx;
+        write(ch->wakeFd, &one, sizeof(one));
+    }
+    for (int i = 0; i < 2 * nPairs; i++)
+    {
+        struct Channel *ch = i % 2 == 0 ? &pairs[i / 2].tx2rx : &pairs[i / 2].rx2tx;
+        while (atomic_load(&ch->applied) != generation)
+        {
+            struct timespec wait = { .tv_sec = 0, .tv_nsec = 100000 };
+            nanosleep(&wait, NULL);
+        }
+    }
+}
+
+
+// Capture writer thread: moves the records in the rings to the file.
+void *capture_writer(void *arg)
+{
+    struct Capture *cap = arg;
+    int stop;
+    do
+    {
+        stop = atomic_load(&cap->stop);
+        for (int i = 0; i < CAPTURE_RINGS; i++)
+        {
+            struct CaptureRing *ring = &cap->rings[i];
+            unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            while (head != tail)
+            {
+                unsigned long first = head % CAPTURE_RING_SIZE;
+                unsigned long n = tail - head;
+                if (n > CAPTURE_RING_SIZE - first)
+                {
+                    n = CAPTURE_RING_SIZE - first;
+                }
+                fwrite(&ring->records[first], sizeof(uint64_t), n, cap->file);
+                head += n;
+            }
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+        }
+
+        if (!stop)
+        {
+            struct timespec period = { .tv_sec = 0, .tv_nsec = CAPTURE_FLUSH_NSEC };
+            nanosleep(&period, NULL);
+        }
+    } while (!stop);
+
+    return NULL;
 }
 
 
-// Make the program use RT priority to improve precision in timing
-void set_rt_priority(void) {
-    struct sched_param sp = { .sched_priority = 50 };
-    if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1) {
-      perror("Could not set realtime priority");
+// Add a record for an event at time "t" to one of the rings of a capture
+// (if logging).
+void capture(struct Capture *cap, int ringIndex, uint8_t flags, unsigned char byte, long long t)
+{
+    if (cap == NULL)
+    {
+        return;
+    }
+
+    struct CaptureRing *ring = &cap->rings[ringIndex];
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == CAPTURE_RING_SIZE)
+    {
+        ring->dropped++;
+        return;
     }
+    ring->records[tail % CAPTURE_RING_SIZE] = CAPTURE_RECORD(t > cap->start ? t - cap->start : 0, flags, byte);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
 }
 
 
-// Compute the difference between two timespecs
-struct timespec timespec_diff(const struct timespec *t2, const struct timespec *t1)
+void free_capture(struct Capture *cap)
 {
-    struct timespec diff = { .tv_sec = t2->tv_sec - t1->tv_sec,
-                             .tv_nsec = t2->tv_nsec - t1->tv_nsec };
-    if (diff.tv_nsec < 0) {
-        diff.tv_nsec += 1000000000;
-        --diff.tv_sec;
+    for (int i = 0; i < CAPTURE_RINGS; i++)
+    {
+        free(cap->rings[i].records);
     }
-    return diff;
+    free(cap);
 }
 
 
-// Compute the sum of two timespecs
-struct timespec timespec_sum(const struct timespec *t1, const struct timespec *t2)
+void endlog(struct Parameters *p, FILE *out)
 {
-    struct timespec sum = { .tv_sec = t1->tv_sec + t2->tv_sec,
-                             .tv_nsec = t1->tv_nsec + t2->tv_nsec };
-    if (sum.tv_nsec >= 1000000000) {
-        sum.tv_nsec -= 1000000000;
-        ++sum.tv_sec;
+    struct Capture *cap = atomic_load(&p->capture);
+    if (cap != NULL)
+    {
+        // No channel adds records once they see the capture gone
+        atomic_store(&p->capture, NULL);
+        update_channels();
+
+        atomic_store(&cap->stop, TRUE);
+        pthread_join(cap->writer, NULL);
+        fclose(cap->file);
+        unsigned long dropped = 0;
+        for (int i = 0; i < CAPTURE_RINGS; i++)
+        {
+            dropped += cap->rings[i].dropped;
+        }
+        if (dropped > 0)
+        {
+            fprintf(out, "CAPTURE LOST %lu RECORDS: COULD NOT WRITE THEM IN TIME\n", dropped);
+        }
+        free_capture(cap);
     }
-    return sum;
 }
 
 
-// Compare two timespecs returning -1, 0 or 1 if t1 is less than, equal or
-// greater than t2, respectively
-int timespec_comp(const struct timespec *t1, const struct timespec *t2)
+void startlog(struct Parameters *p, const char *filename, FILE *out)
 {
-    if (t1->tv_sec < t2->tv_sec) {
-        return -1;
+    endlog(p, out);
+
+    struct Capture *cap = calloc(1, sizeof(struct Capture));
+    if (cap == NULL)
+    {
+        fprintf(out, "OUT OF MEMORY, NOT LOGGING\n");
+        return;
     }
-    else if (t1->tv_sec > t2->tv_sec) {
-        return 1;
+    for (int i = 0; i < CAPTURE_RINGS; i++)
+    {
+        cap->rings[i].records = malloc(CAPTURE_RING_SIZE * sizeof(uint64_t));
+        if (cap->rings[i].records == NULL)
+        {
+            fprintf(out, "OUT OF MEMORY, NOT LOGGING\n");
+            free_capture(cap);
+            return;
+        }
     }
-    else if (t1->tv_nsec < t2->tv_nsec) {
-        return -1;
+
+    cap->file = fopen(filename, "wb");
+    if (cap->file == NULL)
+    {
+        fprintf(out, "ERROR OPENING FILE %s, NOT LOGGING\n", filename);
+        free_capture(cap);
+        return;
     }
-    else if (t1->tv_nsec > t2->tv_nsec) {
-        return 1;
+
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    CaptureHeader header = { .magic = CAPTURE_MAGIC,
+                             .startTime = t.tv_sec * 1000000000ULL + t.tv_nsec };
+    fwrite(&header, sizeof(header), 1, cap->file);
+    cap->start = cable_now();
+
+    if (pthread_create(&cap->writer, NULL, capture_writer, cap) != 0)
+    {
+        fprintf(out, "ERROR STARTING THE LOG WRITER, NOT LOGGING\n");
+        fclose(cap->file);
+        free_capture(cap);
+        return;
     }
-    return 0;
+    atomic_store(&p->capture, cap);
+    update_channels();
+    fprintf(out, "LOGGING TO FILE %s (convert with capture2text)\n", filename);
+}
+
+
+// xoshiro256** (Blackman and Vigna): next 64 random bits.
+uint64_t rng_next(uint64_t s[4])
+{
+    uint64_t x = s[1] * 5;
+    uint64_t result = (x << 7 | x >> 57) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = s[3] << 45 | s[3] >> 19;
+    return result;
 }
 
 
-int timespec_is_negative(const struct timespec *t)
+// Seed the generator state with splitmix64, as recommended for xoshiro.
+void rng_seed(uint64_t s[4], uint64_t seed)
 {
-    if (t->tv_sec < 0 || t->tv_nsec < 0)
+    for (int i = 0; i < 4; i++)
     {
-        return TRUE;
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        s[i] = z ^ (z >> 31);
     }
-    return FALSE;
 }
 
 
-void endlog(void)
+// Number of failures before the first success, in trials with success
+// probability p (LLONG_MAX if p is 0).
+long long geometric(uint64_t s[4], double p)
 {
-    if (par.logfile != NULL)
+    if (p <= 0.0)
+    {
+        return LLONG_MAX;
+    }
+    if (p >= 1.0)
     {
-        fclose(par.logfile);
-        par.logfile = NULL;
+        return 0;
     }
+    double u = ((rng_next(s) >> 11) + 1) * 0x1.0p-53;  // (0, 1]
+    double gap = floor(log(u) / log1p(-p));
+    return gap < (double) LLONG_MAX ? (long long) gap : LLONG_MAX;
 }
 
 
-void startlog(const char *filename)
+// Enter a state of the Gilbert-Elliott model, drawing its length and the
+// gap to the first wrong bit.
+void enter_error_state(struct ErrorModel *em, const struct ErrorParams *ep, int state)
 {
-    endlog();
-    par.logfile = fopen(filename, "w");
-    if (par.logfile != NULL)
+    em->state = state;
+    if (ep->meanBits[0] > 0 && ep->meanBits[1] > 0)
     {
-        fprintf(par.logfile, "Tx->Rx | Rx->Tx\n");
-        printf("LOGGING TO FILE %s\n", filename);
+        em->stateBits = 1 + geometric(em->rng, 1.0 / ep->meanBits[state]);
     }
     else
     {
-        printf("ERROR OPENING FILE %s, NOT LOGGING\n", filename);
+        em->stateBits = LLONG_MAX; // No bursts
     }
+    em->errorBits = geometric(em->rng, ep->ber[state]);
 }
 
 
-// Show help
-void help()
+// Add the bit errors due in the next byte.
+unsigned char add_errors(struct ErrorModel *em, const struct ErrorParams *ep, unsigned char byte)
 {
-    printf("\n\n"
-           "Transmitter must open " TXDEV "\n"
-           "Receiver must open " RXDEV "\n"
-           "\n"
-           "The cable program is sensible to the following interactive commands:\n"
-           "--- help         : show this help\n"
-           "--- on           : connect the cable and data is exchanged (default state)\n"
-           "--- off          : disconnect the cable disabling data to be exchanged\n"
-           "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
-           "--- baud <rate>  : set baud rate, between 1200 and 115200 (default=9600)\n"
-           "                   note that 10 bits are sent per byte (8-N-1)\n"
-           "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
-           "                   will be approximated to an integer multiple of the byte\n"
-           "                   delay (10 / baud_rate)\n"
-           "--- log <file>   : log transmitted data to file\n"
-           "--- endlog       : stop logging transmitted data\n"
-           "--- quit         : terminate the program\n"
-           "\n"
-           "IMPORTANT: Changing the baud rate or propagation delay while a transmission is\n"
-           "           ongoing will result in losses.\n"
-           "\n");
+    int bit = 0;
+    while (TRUE)
+    {
+        long long step = em->errorBits < em->stateBits ? em->errorBits : em->stateBits;
+        if (step >= 8 - bit)
+        {
+            // No more events in this byte
+            em->errorBits -= 8 - bit;
+            em->stateBits -= 8 - bit;
+            return byte;
+        }
+        bit += step;
+        em->errorBits -= step;
+        em->stateBits -= step;
+
+        if (em->stateBits == 0)
+        {
+            enter_error_state(em, ep, !em->state);
+        }
+        else
+        {
+            byte ^= (unsigned char) 1 << bit;
+            bit++;
+            em->stateBits--;
+            em->errorBits = geometric(em->rng, ep->ber[em->state]);
+        }
+    }
 }
 
-int main(int argc, char *argv[])
-{
-    printf("\n");
 
-    system("socat -dd PTY,link=" TXDEV ",mode=777,raw,echo=0 PTY,link=/dev/emulatorTx,mode=777,raw,echo=0 &");
-    sleep(1);
-    printf("\n");
+// Read the bytes waiting at the input of a channel into the cable, as far as
+// the wire backlog allows. The input is throttled (no longer polled) while
+// bytes may remain that did not fit.
+void admit(struct Channel *ch, long long now)
+{
+    // The bucket holds at least one byte, for rates below a byte per tick
+    long long bucket = BUCKET_TICKS * TICK_NSEC > ch->byteDelay ? BUCKET_TICKS * TICK_NSEC : ch->byteDelay;
+    long long backlog = ch->wireFree > now ? ch->wireFree - now : 0;
+    long n = (bucket - backlog) / ch->byteDelay;
+    if (n > ch->size - ch->count) n = ch->size - ch->count;
+    if (n > MAX_BATCH) n = MAX_BATCH;
+
+    unsigned char in[MAX_BATCH];
+    int got = n > 0 ? read(ch->fdIn, in, n) : 0;
+    ch->bytesIn += got > 0 ? got : 0;
+    int cableOn = atomic_load_explicit(&ch->pair->cableOn, memory_order_relaxed);
+    if (!cableOn && got > 0)
+    {
+        atomic_fetch_add_explicit(&ch->stats.dropped, got, memory_order_relaxed);
+    }
+    for (int i = 0; i < got; i++)
+    {
+        // Serialized right after the previous byte, or now if the wire is idle
+        long long slot = ch->wireFree > now ? ch->wireFree : now;
+        ch->wireFree = slot + ch->byteDelay;
 
-    system("socat -dd PTY,link=" RXDEV ",mode=777,raw,echo=0 PTY,link=/dev/emulatorRx,mode=777,raw,echo=0 &");
-    sleep(1);
+        if (!cableOn)
+        {
+            capture(ch->capture, ch->captureRing, ch->direction | CAPTURE_CABLE_OFF, in[i], slot);
+            continue; // Ignore what was read
+        }
+        long tail = (ch->head + ch->count) % ch->size;
+        ch->bytes[tail] = in[i];
+        ch->due[tail] = slot + 1000LL * ch->propDelay;
+        ch->count++;
+        capture(ch->capture, ch->captureRing, ch->direction, in[i], slot);
+    }
 
-    help();
+    // A full batch may have left bytes behind: read them once the wire
+    // backlog is down to about a tick (a byte, at low rates)
+    ch->pending = got == n;
+    ch->resume = ch->wireFree - bucket + (ch->byteDelay > TICK_NSEC ? ch->byteDelay : TICK_NSEC);
+}
 
-    // Configure serial ports
-    struct termios oldtioTx;
-    struct termios newtioTx;
 
-    int fdTx = openSerialPort("/dev/emulatorTx", &oldtioTx, &newtioTx);
+// Deliver the bytes of a channel whose propagation delay has elapsed. Those
+// the output port does not take (its buffer is full) are kept, in order, and
+// written again a tick later.
+void deliver(struct Channel *ch, long long now)
+{
+    int cableOn = atomic_load_explicit(&ch->pair->cableOn, memory_order_relaxed);
 
-    if (fdTx < 0)
+    if (ch->nUnsent > 0 && ch->retry > now)
     {
-        perror("Opening Tx emulator serial port");
-        exit(-1);
+        return;
     }
+    unsigned char *out = ch->unsent;
+    int nOut = ch->nUnsent;
+    int nCorrupted = 0;
+    int nDropped = 0;
+    while (ch->count > 0 && ch->due[ch->head] <= now && nOut < MAX_BATCH)
+    {
+        unsigned char byte = ch->bytes[ch->head];
+        long long due = ch->due[ch->head];
+        ch->head = (ch->head + 1) % ch->size;
+        if (due <= ch->lastDue)
+        {
+            due = ch->lastDue + 1;  // Held back by an earlier byte (delay decreased)
+        }
+        ch->lastDue = due;
+        ch->count--;
 
-    struct termios oldtioRx;
-    struct termios newtioRx;
-
-    int fdRx = openSerialPort("/dev/emulatorRx", &oldtioRx, &newtioRx);
+        uint8_t flags = ch->direction | CAPTURE_DELIVERED;
+        if (!cableOn)
+        {
+            capture(ch->capture, ch->captureRing, flags | CAPTURE_CABLE_OFF, byte, due);
+            nDropped++;
+            continue;
+        }
 
-    if (fdRx < 0)
+        // Add errors, if applicable
+        if (ch->errors.errorBits < 8 || ch->errors.stateBits < 8)
+        {
+            unsigned char sent = byte;
+            byte = add_errors(&ch->errors, &ch->errorParams, byte);
+            if (byte != sent)
+            {
+                flags |= CAPTURE_CORRUPTED;
+                nCorrupted++;
+            }
+        }
+        else
+        {
+            ch->errors.errorBits -= 8;
+            ch->errors.stateBits -= 8;
+        }
+        out[nOut++] = byte;
+        capture(ch->capture, ch->captureRing, flags, byte, due);
+    }
+    if (nOut > 0)
     {
-        perror("Opening Rx emulator serial port");
-        exit(-1);
+        int written = write(ch->fdOut, out, nOut);
+        if (written < 0 && errno != EAGAIN && errno != EINTR)
+        {
+            nDropped += nOut;  // The port is gone: nothing will take them
+            written = nOut;
+        }
+        else if (written > 0)
+        {
+            atomic_fetch_add_explicit(&ch->stats.forwarded, written, memory_order_relaxed);
+        }
+        written = written > 0 ? written : 0;
+        ch->nUnsent = nOut - written;
+        memmove(out, out + written, ch->nUnsent);
+        ch->retry = now + TICK_NSEC;
     }
+    if (nCorrupted > 0)
+    {
+        atomic_fetch_add_explicit(&ch->stats.corrupted, nCorrupted, memory_order_relaxed);
+    }
+    if (nDropped > 0)
+    {
+        atomic_fetch_add_explicit(&ch->stats.dropped, nDropped, memory_order_relaxed);
+    }
+}
 
-    // Configure stdin to receive commands to this program
-    int oldf = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
-
-    char rxStdin[BUF_SIZE] = {0};
-
-    int STOP = FALSE;
 
-    set_baud_rate(DEFAULT_BAUDRATE);
+// Time of the next event of a channel: a byte due, bytes to write again or
+// a throttled input to read (nsec, 0 if none).
+long long next_event(const struct Channel *ch)
+{
+    long long next = 0;
+    if (ch->count > 0)
+    {
+        next = ch->due[ch->head];
+    }
+    if (ch->nUnsent > 0 && (next == 0 || ch->retry > next))
+    {
+        next = ch->retry;
+    }
+    if (ch->pending && (next == 0 || ch->resume < next))
+    {
+        next = ch->resume;
+    }
+    return next;
+}
 
-    set_rt_priority();
 
-    // For logging
-    char tx2rxTx[3], tx2rxRx[3], rx2txTx[3], rx2txRx[3];
-    int cableIdle = FALSE;
+// Poll the input of a channel only when it is not throttled.
+void watch_input(int epfd, struct Channel *ch)
+{
+    if (ch->polled == ch->pending)
+    {
+        ch->polled = !ch->pending;
+        struct epoll_event ev = { .events = ch->polled ? EPOLLIN : 0, .data.ptr = ch };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, ch->fdIn, &ev);
+    }
+}
 
-    printf("\nCable ready\n\n");
 
-    // To compensate for deviations in byte transmission time
-    struct timespec currentTime, nextTxTime, timeDiff, nextWait;
-    int skipWait = FALSE;
-    int unreliableRate = FALSE;
-    clock_gettime(CLOCK_MONOTONIC, &nextTxTime);
+// Apply the settings announced by update_channels() to a channel.
+void apply_settings(struct Channel *ch)
+{
+    unsigned int generation = atomic_load(&scheduler.generation);
+    struct Parameters *p = ch->pair;
+    long byteDelay = atomic_load(&p->byteDelay);
+    unsigned long propDelay = atomic_load(&p->propDelay);
 
-    while (STOP == FALSE)
+    if (byteDelay != ch->byteDelay || propDelay != ch->propDelay)
     {
-        // Check how much waiting time we should have (if any)
-        clock_gettime(CLOCK_MONOTONIC, &currentTime);
-        timeDiff = timespec_diff(&currentTime, &nextTxTime);
-        nextTxTime = timespec_sum(&nextTxTime, &par.byteDelay);
-        if (timeDiff.tv_sec >= 1)
+        ch->byteDelay = byteDelay;
+        ch->propDelay = propDelay;
+        if (init_ring_buffer(ch) != 0)
         {
-            if (unreliableRate == FALSE)
-            {
-                printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
-                       "No further warnings will be issued\n");
-                unreliableRate = TRUE;
-            }
+            printf("OUT OF MEMORY FOR THE PROPAGATION DELAY\n");
+            exit(-1);
         }
-        nextWait = timespec_diff(&nextTxTime, &currentTime);
-        if (timespec_is_negative(&nextWait))
-        {
-            skipWait = TRUE;
-        }
-        else
+    }
+    if (memcmp(&p->errors, &ch->errorParams, sizeof(struct ErrorParams)) != 0)
+    {
+        // Restart the error model (and the random numbers, on a seed command)
+        if (p->errors.seed != ch->errorParams.seed || p->errors.reseeds != ch->errorParams.reseeds)
         {
-            skipWait = FALSE;
+            rng_seed(ch->errors.rng, p->errors.seed ^ ch->direction ^ (uint64_t) p->index << 1);
         }
+        ch->errorParams = p->errors;
+        enter_error_state(&ch->errors, &ch->errorParams, 0);
+    }
+    ch->capture = atomic_load(&p->capture);
+    atomic_store(&ch->applied, generation);
+}
+
+
+// Apply the settings announced by update_channels() to every channel.
+void apply_all_settings(void)
+{
+    for (int i = 0; i < nPairs; i++)
+    {
+        apply_settings(&pairs[i].tx2rx);
+        apply_settings(&pairs[i].rx2tx);
+    }
+}
+
+
+// Run a channel at time "now", if its pair is running: deliver the bytes
+// due and read the input if ready.
+// Returns the time of the next event of the channel (nsec, 0 if none).
+long long run_channel(int epfd, struct Channel *ch, long long now)
+{
+    if (!ch->pair->running)
+    {
+        return 0;
+    }
 
-        // Read from Tx
-        int bytesFromTx = read(fdTx, par.tx2rx + par.tx2rxIdx, 1);
-        par.tx2rxValid[par.tx2rxIdx] = bytesFromTx > 0;
+    deliver(ch, now);
+    if (ch->pending && ch->resume <= now)
+    {
+        admit(ch, now);
+    }
+    watch_input(epfd, ch);
+    atomic_store_explicit(&ch->stats.queued, ch->count + ch->nUnsent, memory_order_relaxed);
+    return next_event(ch);
+}
 
-        // Read from Rx
-        int bytesFromRx = read(fdRx, par.rx2tx + par.rx2txIdx, 1);
-        par.rx2txValid[par.rx2txIdx] = bytesFromRx > 0;
 
-        if (!par.cableOn)
+// Run the channels of every pair at time "now".
+// Returns the time of the next event of any channel (nsec, 0 if none).
+long long run_channels(int epfd, long long now)
+{
+    long long next = 0;
+    for (int i = 0; i < 2 * nPairs; i++)
+    {
+        struct Channel *ch = i % 2 == 0 ? &pairs[i / 2].tx2rx : &pairs[i / 2].rx2tx;
+        long long event = run_channel(epfd, ch, now);
+        if (event > 0 && (next == 0 || event < next))
         {
-            // Ignore what was read
-            par.tx2rxValid[par.tx2rxIdx] = 0;
-            par.rx2txValid[par.rx2txIdx] = 0;
+            next = event;
         }
+    }
+    return next;
+}
+
+
+// Forwarding thread of one direction of a pair.
+void *channel_thread(void *arg)
+{
+    struct Channel *ch = arg;
+    static atomic_int unreliableRate = FALSE;
+
+    // Wake up on bytes at the input port, on a settings change, or when
+    // the timer for the next byte due expires
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    int epfd = epoll_create1(0);
+    if (timerFd < 0 || epfd < 0)
+    {
+        perror("Creating the event loop");
+        exit(-1);
+    }
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.ptr = ch;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ch->fdIn, &ev);
+    ev.data.ptr = &timerFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+    ev.data.ptr = &ch->wakeFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ch->wakeFd, &ev);
+
+    apply_settings(ch);
+    long long timerDeadline = 0;
+
+    while (!atomic_load(&scheduler.stop))
+    {
+        struct epoll_event events[3];
+        int nEvents = epoll_wait(epfd, events, 3, -1);
+        long long now = now_nsec();
 
-        if (par.logfile != NULL)  // Currently logging
+        if (timerDeadline != 0 && now - timerDeadline >= 1000000000LL)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            if (atomic_exchange(&unreliableRate, TRUE) == FALSE)
             {
-                sprintf(tx2rxTx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                printf("UNRELIABLE RATE: Could not keep up, timeDiff exceeded 1s\n"
+                       "No further warnings will be issued\n");
             }
-            else
+        }
+
+        for (int i = 0; i < nEvents; i++)
+        {
+            if (events[i].data.ptr == &timerFd)
             {
-                memcpy(tx2rxTx, "  ", 3);
+                uint64_t expirations;
+                read(timerFd, &expirations, sizeof(expirations));
+                if (timerDeadline != 0)
+                {
+                    long long late = now - timerDeadline;
+                    atomic_fetch_add_explicit(&ch->stats.lateSum, late, memory_order_relaxed);
+                    atomic_fetch_add_explicit(&ch->stats.lateCount, 1, memory_order_relaxed);
+                    if (late > atomic_load_explicit(&ch->stats.lateMax, memory_order_relaxed))
+                    {
+                        atomic_store_explicit(&ch->stats.lateMax, late, memory_order_relaxed);
+                    }
+                }
+                timerDeadline = 0;  // Disarmed
             }
-            if (par.rx2txValid[par.rx2txIdx])
+            else if (events[i].data.ptr == &ch->wakeFd)
             {
-                sprintf(rx2txTx, "%02hhX", par.rx2tx[par.rx2txIdx]);
+                uint64_t count;
+                read(ch->wakeFd, &count, sizeof(count));
+                apply_settings(ch);
             }
             else
             {
-                memcpy(rx2txTx, "  ", 3);
+                // Data ready: read it below. If the port hung up, retry
+                // only after a tick, instead of spinning.
+                ch->pending = TRUE;
+                ch->resume = events[i].events & (EPOLLHUP | EPOLLERR) ? now + TICK_NSEC : now;
             }
         }
 
-        // Advance indices to next position
-        par.tx2rxIdx = (par.tx2rxIdx + 1) % par.bufSize;
-        par.rx2txIdx = (par.rx2txIdx + 1) % par.bufSize;
-
-        if (par.cableOn)
+        // Sleep until the next byte is due (or indefinitely if none)
+        long long next = run_channel(epfd, ch, now);
+        if (next != timerDeadline)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            // Deadlines already past still fire (1 nsec is the earliest)
+            struct itimerspec timer = { 0 };
+            if (next > 0)
             {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.tx2rx[par.tx2rxIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdRx, par.tx2rx + par.tx2rxIdx, 1);
+                timer.it_value.tv_sec = next / 1000000000LL;
+                timer.it_value.tv_nsec = next % 1000000000LL;
             }
+            timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+            timerDeadline = next;
+        }
+    }
+
+    close(epfd);
+    close(timerFd);
+    return NULL;
+}
+
+
+// Channels delivering to and reading from a port
+struct Channel *output_channel(int port)
+{
+    return port % 2 == 0 ? &pairs[port / 2].rx2tx : &pairs[port / 2].tx2rx;
+}
+
+struct Channel *input_channel(int port)
+{
+    return port % 2 == 0 ? &pairs[port / 2].tx2rx : &pairs[port / 2].rx2tx;
+}
+
 
-            if (par.rx2txValid[par.rx2txIdx])
+// Wake up a program attached to the virtual clock.
+// Returns -1 if it is gone.
+int clock_wake(struct ClockClient *c)
+{
+    unsigned long long forwarded = atomic_load(&output_channel(c->port)->stats.forwarded);
+    ClockMessage msg = { .type = CLOCK_WAKE, .time = virtualNow, .delivered = forwarded - c->outBase };
+    c->waiting = FALSE;
+    return send(c->fd, &msg, sizeof(msg), MSG_NOSIGNAL) == sizeof(msg) ? 0 : -1;
+}
+
+
+// Handle a message from a program on the clock socket: attach it to one of
+// the ports, or put it to sleep.
+// Returns -1 if the program is gone or not one of ours.
+int clock_message(struct ClockClient *c)
+{
+    ClockMessage msg;
+    if (recv(c->fd, &msg, sizeof(msg), MSG_WAITALL) != sizeof(msg))
+    {
+        return -1;
+    }
+
+    if (msg.type == CLOCK_HELLO)
+    {
+        for (int i = 0; i < nPorts; i++)
+        {
+            if (strncmp(msg.port, ports[i].pts, sizeof(msg.port)) == 0)
             {
-                // Add error, if applicable
-                if (par.byteER != 0.0 && (double) rand() / (double) RAND_MAX < par.byteER)
-                {
-                    // At most one wrong bit per byte, good enough if ber < 0.02
-                    par.rx2tx[par.rx2txIdx] ^= (char) 1 << rand() % 8;
-                }
-                write(fdTx, par.rx2tx + par.rx2txIdx, 1);
+                c->port = i;
+                c->inBase = input_channel(i)->bytesIn;
+                c->outBase = atomic_load(&output_channel(i)->stats.forwarded);
+                ports[i].attached = TRUE;
+                return clock_wake(c);
             }
         }
+        fprintf(stderr, "Virtual clock: %.*s is not a port of the cable\n", (int) sizeof(msg.port), msg.port);
+    }
+    else if (msg.type == CLOCK_WAIT && c->port >= 0)
+    {
+        c->waiting = TRUE;
+        c->deadline = msg.time;
+        c->written = msg.written;
+        c->read = msg.read;
+        return 0;
+    }
+    return -1;
+}
+
+
+// Run the channels at the current virtual time, then wake up the programs
+// with bytes delivered that they did not read, or whose deadline came.
+// The time of a pair only starts once both its ports have had a program
+// attached.
+// Returns the time of the next event of any channel (nsec, 0 if none).
+long long virtual_step(int epfd)
+{
+    for (int i = 0; i < nPairs; i++)
+    {
+        pairs[i].running = ports[2 * i].attached && ports[2 * i + 1].attached;
+    }
+    long long next = run_channels(epfd, virtualNow);
+
+    for (int i = 0; i < nPorts; i++)
+    {
+        struct ClockClient *c = &clockClients[i];
+        if (c->fd < 0 || !c->waiting)
+        {
+            continue;
+        }
+        long long delivered = atomic_load(&output_channel(c->port)->stats.forwarded) - c->outBase;
+        if ((delivered > c->read || (c->deadline >= 0 && c->deadline <= virtualNow)) &&
+            clock_wake(c) != 0)
+        {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    return next;
+}
+
+
+// Whether virtual time can move on: every program attached is blocked, on a
+// pair that is running, and the cable has read all they wrote (or holds it
+// back, throttled, until a time of its own).
+int can_advance(void)
+{
+    int attached = 0;
+    for (int i = 0; i < nPorts; i++)
+    {
+        struct ClockClient *c = &clockClients[i];
+        if (c->fd < 0)
+        {
+            continue;
+        }
+        if (!c->waiting || !pairs[c->port / 2].running)
+        {
+            return FALSE;
+        }
+        struct Channel *in = input_channel(c->port);
+        if (in->bytesIn - c->inBase < c->written && !in->pending)
+        {
+            return FALSE;
+        }
+        attached++;
+    }
+    return attached > 0;
+}
+
+
+// Time of the next event in virtual time: "next" (the next event of the
+// channels), a program's deadline, or "other" (nsec, 0 if none).
+long long next_virtual_event(long long next, long long other)
+{
+    if (other > 0 && (next == 0 || other < next))
+    {
+        next = other;
+    }
+    for (int i = 0; i < nPorts; i++)
+    {
+        struct ClockClient *c = &clockClients[i];
+        if (c->fd >= 0 && c->waiting && c->deadline >= 0 && (next == 0 || c->deadline < next))
+        {
+            next = c->deadline;
+        }
+    }
+    return next;
+}
+
+
+// Show help
+void help(FILE *out)
+{
+    fprintf(out, "\n\n");
+    for (int i = 0; i < nPairs; i++)
+    {
+        if (nPairs > 1)
+        {
+            fprintf(out, "Pair %d: ", i);
+        }
+        fprintf(out, "Transmitter must open %s\n", ports[2 * i].link);
+        if (nPairs > 1)
+        {
+            fprintf(out, "        ");
+        }
+        fprintf(out, "Receiver must open %s\n", ports[2 * i + 1].link);
+    }
+    fprintf(out, "\n"
+           "The cable program is sensible to the following interactive commands:\n"
+           "--- help         : show this help\n"
+           "--- on           : connect the cable and data is exchanged (default state)\n"
+           "--- off          : disconnect the cable disabling data to be exchanged\n"
+           "--- ber <ber>    : add noise to data bits at a specified BER (default=0)\n"
+           "--- burst <ber> <burst> <gap> : error bursts with a BER of <ber>, lasting <burst>\n"
+           "                   bits every <gap> bits on average (Gilbert-Elliott model);\n"
+           "                   the ber command sets the BER between bursts\n"
+           "--- burst off    : no error bursts (default)\n"
+           "--- seed <n>     : seed the random errors, to repeat a run\n"
+           "--- baud <rate>  : set baud rate, between 1200 and 4000000 (default=9600)\n"
+           "                   note that 10 bits are sent per byte (8-N-1)\n"
+           "--- prop <delay> : set the propagation delay in usec (0-1000000, default=0)\n"
+           "--- stats        : show the traffic counters of each direction\n"
+           "--- stats <s>    : print a traffic summary every <s> seconds (0 to stop)\n"
+           "--- log <file>   : log transmitted data to a binary capture file\n"
+           "--- endlog       : stop logging transmitted data\n"
+           "--- quit         : terminate the program\n"
+           "\n"
+           "With several pairs of ports (-n <pairs>, or a list of ports), each pair has its\n"
+           "own cable: a command applies to every pair, or only to pair <n> if written as\n"
+           "\"@<n> <command>\". Unless for a single pair, \"log <file>\" logs pair <n> to\n"
+           "<file>.<n>.\n"
+           "\n"
+           "Commands can also be scheduled with a scenario file (-s <file>): each line has\n"
+           "the time in seconds since the cable started and a command, as in \"2.5 off\".\n"
+           "A control socket (-c <path>) accepts commands from other programs, one per\n"
+           "line, for example with: echo off | nc -UN <path>\n"
+           "\n"
+           "The baud rate and propagation delay can be changed during a transmission: the\n"
+           "bytes in flight are kept, and delivered in order.\n"
+           "\n"
+           "In virtual time (-v <clock socket>), programs started with the environment\n"
+           "variable CABLE_CLOCK=<clock socket> share a simulated clock with the cable,\n"
+           "which jumps to the next event whenever all of them are blocked: slow links and\n"
+           "long delays run as fast as the computation allows, with the same timings.\n"
+           "\n");
+}
+
+// Bytes per second delivered by a channel since the last report of a kind
+// (STATS_COMMAND or STATS_SUMMARY), whose snapshot is then updated.
+double delivery_rate(struct Channel *ch, int report, long long now)
+{
+    long long since = ch->pair->shownTime[report];
+    unsigned long long forwarded = atomic_load_explicit(&ch->stats.forwarded, memory_order_relaxed);
+    double rate = now > since ? (forwarded - ch->shown[report]) * 1e9 / (now - since) : 0.0;
+    ch->shown[report] = forwarded;
+    return rate;
+}
+
+
+// Print the traffic counters of both directions of a pair.
+void print_stats(struct Parameters *p, FILE *out, long long now)
+{
+    const char *names[] = { "Tx->Rx", "Rx->Tx" };
+    double baud = atomic_load(&p->baudRate);
+    if (nPairs > 1)
+    {
+        fprintf(out, "Pair %d (%s, %s):\n", p->index, ports[2 * p->index].link, ports[2 * p->index + 1].link);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        struct Channel *ch = i == 0 ? &p->tx2rx : &p->rx2tx;
+        struct ChannelStats *st = &ch->stats;
+        double rate = delivery_rate(ch, STATS_COMMAND, now);
+        long long lateCount = atomic_load_explicit(&st->lateCount, memory_order_relaxed);
+        long long lateSum = atomic_load_explicit(&st->lateSum, memory_order_relaxed);
+
+        fprintf(out, "%s: %llu bytes forwarded, %llu corrupted, %llu dropped (cable off)\n"
+                     "        %.0f bytes/s (%.1f%% of %.0f baud), %ld bytes in flight\n"
+                     "        timer lateness %.3f ms average, %.3f ms max\n",
+                names[i],
+                atomic_load_explicit(&st->forwarded, memory_order_relaxed),
+                atomic_load_explicit(&st->corrupted, memory_order_relaxed),
+                atomic_load_explicit(&st->dropped, memory_order_relaxed),
+                rate, rate * 1000 / baud, baud,
+                atomic_load_explicit(&st->queued, memory_order_relaxed),
+                lateCount > 0 ? lateSum / 1e6 / lateCount : 0.0,
+                atomic_load_explicit(&st->lateMax, memory_order_relaxed) / 1e6);
+    }
+    p->shownTime[STATS_COMMAND] = now;
+}
+
+
+// Print the one-line periodic summary of each pair: rate, share of the baud
+// rate, bytes in flight and maximum timer lateness of each direction.
+void print_summary(long long now, long long start)
+{
+    for (int j = 0; j < nPairs; j++)
+    {
+        struct Parameters *p = &pairs[j];
+        double baud = atomic_load(&p->baudRate);
+        printf("[%.3f s]", (now - start) / 1e9);
+        if (nPairs > 1)
+        {
+            printf(" #%d", j);
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            struct Channel *ch = i == 0 ? &p->tx2rx : &p->rx2tx;
+            double rate = delivery_rate(ch, STATS_SUMMARY, now);
+            printf(" %s %.0f B/s %.1f%% %ld queued %.3f ms late%s",
+                   i == 0 ? "Tx->Rx" : "Rx->Tx", rate, rate * 1000 / baud,
+                   atomic_load_explicit(&ch->stats.queued, memory_order_relaxed),
+                   atomic_load_explicit(&ch->stats.lateMax, memory_order_relaxed) / 1e6,
+                   i == 0 ? " |" : "\n");
+        }
+        p->shownTime[STATS_SUMMARY] = now;
+    }
+}
+
+
+// Interval of the periodic summary (nsec, 0 if off), set by the stats command
+long long statsInterval = 0;
+
+
+// Run a cable command, printing the outcome to "out". The command applies
+// to every pair, or to a single one if prefixed by "@<n> ".
+// Returns TRUE if the cable must quit.
+int run_command(const char *command, FILE *out)
+{
+    long long now = cable_now();
+    int first = 0;
+    int last = nPairs - 1;
+    if (command[0] == '@')
+    {
+        int pair, offset;
+        if (sscanf(command + 1, "%d %n", &pair, &offset) < 1 || pair < 0 || pair >= nPairs)
+        {
+            fprintf(out, "BAD PAIR (MUST BE FROM 0 TO %d)\n", nPairs - 1);
+            return FALSE;
+        }
+        first = last = pair;
+        command += 1 + offset;
+    }
 
-        if (par.logfile != NULL)  // Currently logging
+    if (strcmp(command, "off") == 0)
+    {
+        fprintf(out, "CONNECTION OFF\n");
+        for (int i = first; i <= last; i++)
         {
-            if (par.tx2rxValid[par.tx2rxIdx])
+            if (atomic_exchange(&pairs[i].cableOn, FALSE))
             {
-                sprintf(tx2rxRx, "%02hhX", par.tx2rx[par.tx2rxIdx]);
+                capture(pairs[i].capture, CAPTURE_COMMAND_RING, CAPTURE_COMMAND, FALSE, now);
             }
-            else
+        }
+    }
+    else if (strcmp(command, "on") == 0)
+    {
+        fprintf(out, "CONNECTION ON\n");
+        for (int i = first; i <= last; i++)
+        {
+            if (!atomic_exchange(&pairs[i].cableOn, TRUE))
+            {
+                capture(pairs[i].capture, CAPTURE_COMMAND_RING, CAPTURE_COMMAND, TRUE, now);
+            }
+        }
+    }
+    else if (strncmp(command, "ber ", 4) == 0)
+    {
+        double ber;
+        if (sscanf(command + 4, "%lf", &ber) == 1 && ber >= 0.0 && ber < 1.0)
+        {
+            for (int i = first; i <= last; i++)
+            {
+                pairs[i].errors.ber[0] = ber;
+            }
+            update_channels();
+            fprintf(out, "BER SET TO %lf\n", ber);
+        }
+        else
+        {
+            fprintf(out, "BAD BER VALUE (MUST BE 0 <= BER < 1.0)\n");
+        }
+    }
+    else if (strcmp(command, "burst off") == 0)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            pairs[i].errors.meanBits[0] = pairs[i].errors.meanBits[1] = 0.0;
+        }
+        update_channels();
+        fprintf(out, "ERROR BURSTS OFF\n");
+    }
+    else if (strncmp(command, "burst ", 6) == 0)
+    {
+        double ber, burstBits, gapBits;
+        if (sscanf(command + 6, "%lf %lf %lf", &ber, &burstBits, &gapBits) == 3 &&
+            ber >= 0.0 && ber <= 1.0 && burstBits >= 1.0 && gapBits >= 1.0)
+        {
+            for (int i = first; i <= last; i++)
+            {
+                pairs[i].errors.ber[1] = ber;
+                pairs[i].errors.meanBits[1] = burstBits;
+                pairs[i].errors.meanBits[0] = gapBits;
+            }
+            update_channels();
+            fprintf(out, "ERROR BURSTS: BER %lf FOR %.0lf BITS EVERY %.0lf BITS (MEAN)\n",
+                    ber, burstBits, gapBits);
+        }
+        else
+        {
+            fprintf(out, "BAD BURST PARAMETERS (BER FROM 0 TO 1, LENGTHS OF AT LEAST 1 BIT)\n");
+        }
+    }
+    else if (strncmp(command, "seed ", 5) == 0)
+    {
+        unsigned long long seed;
+        if (sscanf(command + 5, "%llu", &seed) == 1)
+        {
+            for (int i = first; i <= last; i++)
+            {
+                pairs[i].errors.seed = seed;
+                pairs[i].errors.reseeds++;
+            }
+            update_channels();
+            fprintf(out, "ERROR SEED SET TO %llu\n", seed);
+        }
+        else
+        {
+            fprintf(out, "BAD SEED\n");
+        }
+    }
+    else if (strncmp(command, "baud ", 5) == 0)
+    {
+        unsigned long baud = 0;
+        sscanf(command + 5, "%lu", &baud);
+        // Any rate is emulated, as the ptys ignore their own setting
+        if (baud >= MIN_BAUDRATE && baud <= MAX_BAUDRATE)
+        {
+            for (int i = first; i <= last; i++)
+            {
+                set_baud_rate(&pairs[i], baud);
+            }
+            fprintf(out, "BAUD RATE: %lu\n", baud);
+            update_channels();
+        }
+        else
+        {
+            fprintf(out, "UNSUPPORTED BAUD RATE: must be between %d and %d\n", MIN_BAUDRATE, MAX_BAUDRATE);
+        }
+    }
+    else if (strncmp(command, "prop ", 5) == 0)
+    {
+        unsigned long propDelay;
+        if (sscanf(command + 5, "%lu", &propDelay) < 1 || propDelay > 1000000)
+        {
+            fprintf(out, "BAD OR OUT OF RANGE PROPAGATION DELAY\n");
+        }
+        else
+        {
+            for (int i = first; i <= last; i++)
             {
-                memcpy(tx2rxRx, "  ", 3);
+                atomic_store(&pairs[i].propDelay, propDelay);
             }
-            if (par.rx2txValid[par.rx2txIdx])
+            update_channels();
+            fprintf(out, "PROPAGATION DELAY SET TO %lu usec\n", propDelay);
+        }
+    }
+    else if (strncmp(command, "log ", 4) == 0)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            if (first == last)
             {
-                sprintf(rx2txRx, "%02hhX", par.rx2tx[par.rx2txIdx]);
+                startlog(&pairs[i], command + 4, out);
             }
             else
             {
-                memcpy(rx2txRx, "  ", 3);
+                char filename[PATH_MAX];
+                snprintf(filename, sizeof(filename), "%s.%d", command + 4, i);
+                startlog(&pairs[i], filename, out);
+            }
+        }
+    }
+    else if (strcmp(command, "endlog") == 0)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            endlog(&pairs[i], out);
+        }
+        fprintf(out, "NOT LOGGING\n");
+    }
+    else if (strcmp(command, "quit") == 0)
+    {
+        fprintf(out, "END OF THE PROGRAM\n");
+        return TRUE;
+    }
+    else if (strcmp(command, "stats") == 0)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            print_stats(&pairs[i], out, now);
+        }
+    }
+    else if (strncmp(command, "stats ", 6) == 0)
+    {
+        double seconds;
+        if (sscanf(command + 6, "%lf", &seconds) == 1 && seconds >= 0)
+        {
+            statsInterval = (long long) (seconds * 1e9);
+            fprintf(out, seconds > 0 ? "TRAFFIC SUMMARY EVERY %g s\n" : "NO TRAFFIC SUMMARY\n", seconds);
+        }
+        else
+        {
+            fprintf(out, "BAD STATS INTERVAL\n");
+        }
+    }
+    else if (strcmp(command, "help") == 0)
+    {
+        help(out);
+    }
+    else if (command[0] != '\0')
+    {
+        fprintf(out, "BAD COMMAND OR MISSING PARAMETERS\n");
+    }
+
+    return FALSE;
+}
+
+
+// Read the commands available from a source, running each complete line.
+// Returns TRUE if the cable must quit, -1 once the source is closed.
+int read_commands(struct CommandSource *src)
+{
+    int n = read(src->fd, src->buf + src->len, sizeof(src->buf) - 1 - src->len);
+    if (n <= 0)
+    {
+        return -1;
+    }
+    src->len += n;
+    src->buf[src->len] = '\0';
+
+    int stop = FALSE;
+    char *line = src->buf;
+    char *end;
+    while (!stop && (end = strchr(line, '\n')) != NULL)
+    {
+        *end = '\0';
+        if (src->fd == STDIN_FILENO)
+        {
+            stop = run_command(line, stdout);
+        }
+        else
+        {
+            // Send the outcome back to the client
+            char *reply = NULL;
+            size_t size = 0;
+            FILE *out = open_memstream(&reply, &size);
+            stop = run_command(line, out);
+            fclose(out);
+            send(src->fd, reply, size, MSG_NOSIGNAL);
+            free(reply);
+        }
+        line = end + 1;
+    }
+
+    // Keep an incomplete line for later (or drop it, if too long)
+    src->len -= line - src->buf;
+    memmove(src->buf, line, src->len);
+    if (src->len == sizeof(src->buf) - 1)
+    {
+        src->len = 0;
+    }
+    return stop;
+}
+
+
+// Load a scenario: lines "<time> <command>", with the time in seconds since
+// the cable started, in non-decreasing order. Empty lines and lines starting
+// with '#' are ignored.
+// Returns the number of commands loaded, or -1 on error.
+int load_scenario(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror(filename);
+        return -1;
+    }
+
+    char line[BUF_SIZE];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *start = line + strspn(line, " \t");
+        if (*start == '\0' || *start == '#')
+        {
+            continue;
+        }
+
+        double time;
+        int offset;
+        if (sscanf(start, "%lf %n", &time, &offset) < 1 || time < 0 ||
+            (scenario.count > 0 && time * 1e9 < scenario.steps[scenario.count - 1].time))
+        {
+            fprintf(stderr, "%s:%d: bad or out of order time\n", filename, lineNumber);
+            fclose(file);
+            return -1;
+        }
+
+        struct ScenarioStep *steps = realloc(scenario.steps, (scenario.count + 1) * sizeof(struct ScenarioStep));
+        char *command = strdup(start + offset);
+        if (steps == NULL || command == NULL)
+        {
+            fclose(file);
+            return -1;
+        }
+        scenario.steps = steps;
+        scenario.steps[scenario.count].time = (long long) (time * 1e9);
+        scenario.steps[scenario.count].command = command;
+        scenario.count++;
+    }
+
+    fclose(file);
+    return scenario.count;
+}
+
+
+// Create a control (or clock) socket, replacing a stale one (no cable
+// listening).
+// Returns the listening socket, or -1 on error.
+int open_control_socket(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int inUse = errno != EADDRINUSE ||
+                    connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0 ||
+                    errno != ECONNREFUSED;
+        close(probe);
+        if (inUse || unlink(path) != 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, MAX_CLIENTS) != 0)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+
+int main(int argc, char *argv[])
+{
+    printf("\n");
+
+    const char *scenarioFile = NULL;
+    const char *controlSocket = NULL;
+    const char *clockSocket = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:v:n:")) != -1)
+    {
+        if (opt == 's')
+        {
+            scenarioFile = optarg;
+        }
+        else if (opt == 'c')
+        {
+            controlSocket = optarg;
+        }
+        else if (opt == 'v')
+        {
+            clockSocket = optarg;
+            virtualMode = TRUE;
+        }
+        else if (opt == 'n' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_PAIRS)
+        {
+            nPairs = atoi(optarg);
+        }
+        else
+        {
+            argc = 0; // Show usage
+        }
+    }
+    int nLinks = argc - optind;
+    if (argc == 0 || nLinks % 2 != 0 || nLinks > 2 * MAX_PAIRS || (nLinks > 0 && nPairs > 0))
+    {
+        printf("Usage: %s [-s <scenario file>] [-c <control socket>] [-v <clock socket>]\n"
+               "       [-n <pairs> | <tx port> <rx port>...]\n"
+               "  At most %d pairs of ports\n", argv[0], MAX_PAIRS);
+        exit(1);
+    }
+
+    // The ports: given, numbered from /dev/ttyS10, or the default pair
+    if (nLinks > 0)
+    {
+        nPairs = nLinks / 2;
+    }
+    else if (nPairs == 0)
+    {
+        nPairs = 1;
+    }
+    nPorts = 2 * nPairs;
+    pairs = calloc(nPairs, sizeof(struct Parameters));
+    ports = calloc(nPorts, sizeof(struct Port));
+    clockClients = calloc(nPorts, sizeof(struct ClockClient));
+    if (pairs == NULL || ports == NULL || clockClients == NULL)
+    {
+        perror("Creating the cable");
+        exit(-1);
+    }
+    for (int i = 0; i < nPorts; i++)
+    {
+        char link[32];
+        snprintf(link, sizeof(link), "/dev/ttyS%d", FIRST_TTY + i);
+        ports[i].link = nLinks > 0 ? argv[optind + i] : nPairs == 1 ? (i == 0 ? TXDEV : RXDEV) : strdup(link);
+        clockClients[i].fd = -1;
+    }
+
+    if (scenarioFile != NULL && load_scenario(scenarioFile) < 0)
+    {
+        exit(1);
+    }
+
+    // Create the serial ports
+    for (int i = 0; i < nPorts; i++)
+    {
+        if (openPort(&ports[i]) < 0)
+        {
+            perror(i % 2 == 0 ? "Creating Tx serial port" : "Creating Rx serial port");
+            while (--i >= 0)
+            {
+                closePort(&ports[i]);
+            }
+            exit(-1);
+        }
+    }
+
+    struct sigaction action = { .sa_handler = onSignal };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+
+    int listenFd = -1;
+    if (controlSocket != NULL && (listenFd = open_control_socket(controlSocket)) < 0)
+    {
+        perror("Creating the control socket");
+        onSignal(0);
+    }
+    controlPath = controlSocket;
+
+    int clockFd = -1;
+    if (clockSocket != NULL && (clockFd = open_control_socket(clockSocket)) < 0)
+    {
+        perror("Creating the clock socket");
+        onSignal(0);
+    }
+    clockPath = clockSocket;
+
+    help(stdout);
+
+    int STOP = FALSE;
+
+    uint64_t seed = (uint64_t) now_nsec();
+    for (int i = 0; i < nPairs; i++)
+    {
+        struct Parameters *p = &pairs[i];
+        p->index = i;
+        p->cableOn = TRUE;
+        p->errors.seed = seed;
+        p->running = !virtualMode;
+        set_baud_rate(p, DEFAULT_BAUDRATE);
+        p->tx2rx = (struct Channel) { .pair = p, .fdIn = ports[2 * i].fd, .fdOut = ports[2 * i + 1].fd,
+                                      .direction = 0, .captureRing = CAPTURE_TX2RX_RING, .polled = TRUE };
+        p->rx2tx = (struct Channel) { .pair = p, .fdIn = ports[2 * i + 1].fd, .fdOut = ports[2 * i].fd,
+                                      .direction = CAPTURE_RX2TX, .captureRing = CAPTURE_RX2TX_RING, .polled = TRUE };
+    }
+    printf("BAUD RATE: %d\n", DEFAULT_BAUDRATE);
+    printf("ERROR SEED: %llu\n", (unsigned long long) seed);
+    printf("PROPAGATION DELAY SET TO %lu usec\n", atomic_load(&pairs[0].propDelay));
+
+    if (virtualMode)
+    {
+        // Run by the event loop below; the inputs are polled once time starts
+        for (int i = 0; i < nPairs; i++)
+        {
+            pairs[i].tx2rx.polled = pairs[i].rx2tx.polled = FALSE;
+        }
+        apply_all_settings();
+    }
+    else
+    {
+        for (int i = 0; i < 2 * nPairs; i++)
+        {
+            struct Channel *ch = i % 2 == 0 ? &pairs[i / 2].tx2rx : &pairs[i / 2].rx2tx;
+            ch->wakeFd = eventfd(0, EFD_NONBLOCK);
+            if (ch->wakeFd < 0 || pthread_create(&ch->thread, NULL, channel_thread, ch) != 0)
+            {
+                perror("Starting the cable");
+                exit(-1);
             }
+        }
+    }
 
-            if (*tx2rxTx == ' ' && *rx2txTx == ' ' && *tx2rxRx == ' ' && *rx2txRx == ' ')
+    // Commands come from stdin, the clients of the control socket, and the
+    // scenario (when its timer expires)
+    int epfd = epoll_create1(0);
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    int statsFd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (epfd < 0 || timerFd < 0 || statsFd < 0)
+    {
+        perror("Creating the event loop");
+        exit(-1);
+    }
+
+    struct CommandSource *sources[MAX_CLIENTS + 1] = { NULL };
+    struct epoll_event ev = { .events = EPOLLIN };
+    sources[0] = calloc(1, sizeof(struct CommandSource));
+    sources[0]->fd = STDIN_FILENO;
+    ev.data.ptr = sources[0];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+    ev.data.ptr = &listenFd;
+    if (listenFd >= 0)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listenFd, &ev);
+    }
+    ev.data.ptr = &timerFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, timerFd, &ev);
+    ev.data.ptr = &statsFd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, statsFd, &ev);
+    if (clockFd >= 0)
+    {
+        ev.data.ptr = &clockFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clockFd, &ev);
+        for (int i = 0; i < nPorts; i++)
+        {
+            struct epoll_event input = { .events = 0, .data.ptr = input_channel(i) };
+            epoll_ctl(epfd, EPOLL_CTL_ADD, ports[i].fd, &input);
+        }
+    }
+
+    long long start = cable_now();
+    long long summaryInterval = 0;
+    long long nextSummary = 0;  // In virtual time
+    for (int i = 0; i < nPairs; i++)
+    {
+        pairs[i].shownTime[STATS_COMMAND] = pairs[i].shownTime[STATS_SUMMARY] = start;
+    }
+    int nextStep = 0;
+
+    printf("\nCable ready\n\n");
+
+    while (STOP == FALSE)
+    {
+        // Run the scenario steps due, then wait for the next one
+        long long now = cable_now();
+        while (!STOP && nextStep < scenario.count && start + scenario.steps[nextStep].time <= now)
+        {
+            printf("[%.3f s] %s\n", (now - start) / 1e9, scenario.steps[nextStep].command);
+            STOP = run_command(scenario.steps[nextStep].command, stdout);
+            nextStep++;
+        }
+        if (STOP)
+        {
+            break;
+        }
+        if (nextSummary != 0 && nextSummary <= now)
+        {
+            print_summary(now, start);
+            nextSummary += summaryInterval;
+        }
+        struct itimerspec timer = { 0 };
+        if (nextStep < scenario.count && !virtualMode)
+        {
+            long long next = start + scenario.steps[nextStep].time;
+            timer.it_value.tv_sec = next / 1000000000LL;
+            timer.it_value.tv_nsec = next % 1000000000LL;
+        }
+        timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+
+        if (statsInterval != summaryInterval)
+        {
+            // Restart the periodic summary
+            summaryInterval = statsInterval;
+            struct itimerspec period = {
+                .it_value = { summaryInterval / 1000000000LL, summaryInterval % 1000000000LL },
+                .it_interval = { summaryInterval / 1000000000LL, summaryInterval % 1000000000LL } };
+            if (virtualMode)
             {
-                if (cableIdle == FALSE)
-                {
-                    fputs("---------------\n", par.logfile);
-                    cableIdle = TRUE;
-                }
+                nextSummary = summaryInterval > 0 ? now + summaryInterval : 0;
             }
             else
             {
-                fprintf(par.logfile, "%s  %s | %s  %s\n", tx2rxTx, tx2rxRx, rx2txTx, rx2txRx);
-                cableIdle = FALSE;
+                timerfd_settime(statsFd, 0, &period, NULL);
+            }
+            for (int i = 0; i < nPairs; i++)
+            {
+                pairs[i].shownTime[STATS_SUMMARY] = now;
+                pairs[i].tx2rx.shown[STATS_SUMMARY] = atomic_load(&pairs[i].tx2rx.stats.forwarded);
+                pairs[i].rx2tx.shown[STATS_SUMMARY] = atomic_load(&pairs[i].rx2tx.stats.forwarded);
             }
         }
 
-        // Read commands from STDIN to control the cable mode
-        int fromStdin = read(STDIN_FILENO, rxStdin, BUF_SIZE);
-        if (fromStdin > 0)
+        // In virtual time, run the channels, then move the clock on if
+        // nothing else is going to happen at the current time
+        int timeout = -1;
+        long long next = 0;
+        if (virtualMode)
         {
-            rxStdin[fromStdin - 1] = '\0';
-
-            if (strcmp(rxStdin, "off") == 0)
+            // The next scenario step or summary, whichever comes first
+            long long other = nextSummary;
+            if (nextStep < scenario.count && (other == 0 || start + scenario.steps[nextStep].time < other))
             {
-                printf("CONNECTION OFF\n");
-                if (par.cableOn && par.logfile != NULL)
-                {
-                    fputs("CABLE OFF\n", par.logfile);
-                }
-                par.cableOn = FALSE;
+                other = start + scenario.steps[nextStep].time;
             }
-            else if (strcmp(rxStdin, "on") == 0)
+            next = virtual_step(epfd);
+            next = next_virtual_event(next, other);
+            timeout = next > 0 && (next <= now || can_advance()) ? 0 : -1;
+        }
+
+        struct epoll_event events[MAX_CLIENTS + 4 * MAX_PAIRS + 4];
+        int nEvents = epoll_wait(epfd, events, MAX_CLIENTS + 4 * MAX_PAIRS + 4, timeout);
+        if (nEvents == 0 && next > now && can_advance())
+        {
+            virtualNow = next;
+        }
+        for (int i = 0; i < nEvents && !STOP; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            if (ptr >= (void *) pairs && ptr < (void *) (pairs + nPairs))
             {
-                printf("CONNECTION ON\n");
-                par.cableOn = TRUE;
+                // Bytes at an input, in virtual time
+                struct Channel *ch = ptr;
+                ch->pending = TRUE;
+                ch->resume = events[i].events & (EPOLLHUP | EPOLLERR) ? now + TICK_NSEC : now;
             }
-            else if (strncmp(rxStdin, "ber ", 4) == 0)
+            else if (ptr == &clockFd)
             {
-                double ber;
-                sscanf(rxStdin + 4, "%lf", &ber);
-                // Compute pow(1 - ber, 8) without libm
-                double acc = 1 - ber;
-                acc *= acc;   // Squared
-                acc *= acc;   // To the fourth
-                acc *= acc;   // To the eightth
-                par.byteER = 1.0 - acc;
-                //printf("Byte Error Rate is %lf\n", par.byteER);
-                if (ber >= 0.0 && ber < 1.0)
+                int fd = accept4(clockFd, NULL, NULL, SOCK_CLOEXEC);
+                int slot = 0;
+                while (slot < nPorts && clockClients[slot].fd >= 0)
                 {
-                    printf("BER SET TO %lf\n", ber);
-                    if (ber > 0.01)
-                    {
-                        printf("   ACTUAL BER WILL BE LOWER THAN DEFINED FOR VALUES ABOVE 0.01\n");
-                    }
+                    slot++;
                 }
-                else
+                if (fd >= 0 && slot < nPorts)
                 {
-                    printf("BAD BER VALUE %lf (MUST BE 0 <= BER < 1.0)", ber);
+                    clockClients[slot] = (struct ClockClient) { .fd = fd, .port = -1 };
+                    ev.data.ptr = &clockClients[slot];
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
                 }
-            }
-            else if (strncmp(rxStdin, "baud ", 5) == 0)
-            {
-                unsigned long baud = 0;
-                sscanf(rxStdin + 5, "%lu", &baud);
-                switch (baud) {
-                    case 1200:
-                    case 1800:
-                    case 2400:
-                    case 4800:
-                    case 9600:
-                    case 19200:
-                    case 38400:
-                    case 57600:
-                    case 115200:
-                        set_baud_rate(baud);
-                        break;
-                    default:
-                        printf("UNSUPPORTED BAUD RATE: must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600 or 115200\n");
+                else if (fd >= 0)
+                {
+                    close(fd); // Too many programs
                 }
             }
-            else if (strncmp(rxStdin, "prop ", 5) == 0)
+            else if (ptr >= (void *) clockClients && ptr < (void *) (clockClients + nPorts))
             {
-                unsigned long propDelay;
-                if (sscanf(rxStdin + 5, "%lu", &propDelay) < 1 || propDelay > 1000000)
+                struct ClockClient *c = ptr;
+                if (c->fd >= 0 && clock_message(c) != 0)
                 {
-                    printf("BAD OR OUT OF RANGE PROPAGATION DELAY\n");
-                }
-                else
-                {
-                    par.propDelay = propDelay;
-                    init_ring_buffers();
+                    close(c->fd);  // Gone: no longer holds the clock back
+                    c->fd = -1;
                 }
             }
-            else if (strncmp(rxStdin, "log ", 4) == 0)
+            else if (ptr == &timerFd)
             {
-                startlog(rxStdin + 4);
+                uint64_t expirations;
+                read(timerFd, &expirations, sizeof(expirations));
             }
-            else if (strcmp(rxStdin, "endlog") == 0)
+            else if (ptr == &statsFd)
             {
-                endlog();
-                printf("NOT LOGGING\n");
+                uint64_t expirations;
+                read(statsFd, &expirations, sizeof(expirations));
+                print_summary(cable_now(), start);
             }
-            else if (strcmp(rxStdin, "quit") == 0)
+            else if (ptr == &listenFd)
             {
-                printf("END OF THE PROGRAM\n");
-                STOP = TRUE;
-            }
-            else if (strcmp(rxStdin, "help") == 0) {
-                help();
+                int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+                int slot = 1;
+                while (slot <= MAX_CLIENTS && sources[slot] != NULL)
+                {
+                    slot++;
+                }
+                if (fd >= 0 && slot <= MAX_CLIENTS &&
+                    (sources[slot] = calloc(1, sizeof(struct CommandSource))) != NULL)
+                {
+                    sources[slot]->fd = fd;
+                    ev.data.ptr = sources[slot];
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                else if (fd >= 0)
+                {
+                    close(fd); // Too many clients
+                }
             }
-            else {
-                printf("BAD COMMAND OR MISSING PARAMETERS\n");
+            else
+            {
+                struct CommandSource *src = ptr;
+                STOP = read_commands(src);
+                if (STOP < 0)
+                {
+                    // Source closed: stdin stops, but the cable goes on
+                    STOP = FALSE;
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, src->fd, NULL);
+                    for (int j = 1; j <= MAX_CLIENTS; j++)
+                    {
+                        if (sources[j] == src)
+                        {
+                            close(src->fd);
+                            free(src);
+                            sources[j] = NULL;
+                        }
+                    }
+                }
             }
         }
+    }
 
-        if (skipWait == FALSE) {
-            nanosleep(&nextWait, NULL);
+    for (int i = 1; i <= MAX_CLIENTS; i++)
+    {
+        if (sources[i] != NULL)
+        {
+            close(sources[i]->fd);
+            free(sources[i]);
         }
     }
-
-    // Restore the old port settings
-    if (tcsetattr(fdRx, TCSANOW, &oldtioRx) == -1)
+    free(sources[0]);
+    if (listenFd >= 0)
     {
-        perror("tcsetattr");
-        exit(-1);
+        close(listenFd);
+        unlink(controlSocket);
     }
-
-    if (tcsetattr(fdTx, TCSANOW, &oldtioTx) == -1)
+    for (int i = 0; i < nPorts; i++)
     {
-        perror("tcsetattr");
-        exit(-1);
+        if (clockClients[i].fd >= 0)
+        {
+            close(clockClients[i].fd);
+        }
+    }
+    if (clockFd >= 0)
+    {
+        close(clockFd);
+        unlink(clockSocket);
     }
+    close(statsFd);
+    close(timerFd);
+    close(epfd);
 
-    close(fdTx);
-    close(fdRx);
+    for (int i = 0; i < nPairs; i++)
+    {
+        endlog(&pairs[i], stdout);
+    }
+    atomic_store(&scheduler.stop, TRUE);
+    update_channels();
+    if (!virtualMode)
+    {
+        for (int i = 0; i < 2 * nPairs; i++)
+        {
+            struct Channel *ch = i % 2 == 0 ? &pairs[i / 2].tx2rx : &pairs[i / 2].rx2tx;
+            pthread_join(ch->thread, NULL);
+            close(ch->wakeFd);
+        }
+    }
 
-    system("killall socat");
+    for (int i = 0; i < nPorts; i++)
+    {
+        closePort(&ports[i]);
+        close(ports[i].slaveFd);
+        close(ports[i].fd);
+    }
 
     return 0;
 }
@@ -0,0 +1,37 @@
+// Binary capture format of the virtual cable ("log <file>" command).
+// A capture is a CaptureHeader followed by one 64-bit record per event, in
+// host byte order:
+//   bits 63..16  time since the start of the capture (nsec)
+//   bits 15..8   CAPTURE_* flags
+//   bits  7..0   byte
+// Records are in time order for each direction, but the two directions (and
+// the on/off commands) are interleaved in chunks: sort them by time first.
+// Convert a capture to text with bin/capture2text.
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "CBLCAP1"
+
+// Record flags
+#define CAPTURE_RX2TX     0x01 // Direction Rx->Tx (Tx->Rx if clear)
+#define CAPTURE_DELIVERED 0x02 // Byte leaving the cable (entering if clear)
+#define CAPTURE_CORRUPTED 0x04 // Errors were added to the byte
+#define CAPTURE_CABLE_OFF 0x08 // Byte lost, as the cable was off
+#define CAPTURE_COMMAND   0x10 // Not a byte: the cable was turned off (0) or on (1)
+
+typedef struct
+{
+    char magic[8];           // CAPTURE_MAGIC
+    uint64_t startTime;      // Start of the capture (CLOCK_REALTIME, nsec)
+} CaptureHeader;
+
+#define CAPTURE_RECORD(time, flags, byte) \
+    ((uint64_t) (time) << 16 | (uint64_t) (flags) << 8 | (uint8_t) (byte))
+#define CAPTURE_TIME(record) ((record) >> 16)
+#define CAPTURE_FLAGS(record) ((uint8_t) ((record) >> 8))
+#define CAPTURE_BYTE(record) ((uint8_t) (record))
+
+#endif // _CAPTURE_H_
@@ -0,0 +1,117 @@
+// Convert a binary capture of the virtual cable to the text view
+// "Tx->Rx | Rx->Tx", with the bytes entering and leaving the cable in each
+// direction. Gaps in the traffic are marked with a separator.
+//
+// Usage: capture2text <capture> [<text file>]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+#define IDLE_GAP_NSEC 1000000 // Gap marked with a separator
+
+// Order records by time (then by flags: bytes entering before leaving)
+int compare_records(const void *a, const void *b)
+{
+    uint64_t ra = *(const uint64_t *) a;
+    uint64_t rb = *(const uint64_t *) b;
+    return ra < rb ? -1 : ra > rb;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        printf("Usage: %s <capture> [<text file>]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+    {
+        printf("%s is not a cable capture\n", argv[1]);
+        return 1;
+    }
+
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    // Load and sort all the records
+    size_t count = 0;
+    size_t capacity = 1 << 16;
+    uint64_t *records = malloc(capacity * sizeof(uint64_t));
+    size_t n;
+    while (records != NULL &&
+           (n = fread(records + count, sizeof(uint64_t), capacity - count, in)) > 0)
+    {
+        count += n;
+        if (count == capacity)
+        {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(uint64_t));
+        }
+    }
+    if (records == NULL)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+    qsort(records, count, sizeof(uint64_t), compare_records);
+
+    fprintf(out, "Tx->Rx | Rx->Tx\n");
+
+    uint64_t lastTime = 0;
+    int first = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t record = records[i];
+        uint8_t flags = CAPTURE_FLAGS(record);
+        if (flags & CAPTURE_COMMAND)
+        {
+            if (CAPTURE_BYTE(record) == 0)
+            {
+                fprintf(out, "CABLE OFF\n");
+            }
+            continue;
+        }
+        if (flags & CAPTURE_CABLE_OFF)
+        {
+            continue; // Never got through
+        }
+
+        if (first || CAPTURE_TIME(record) - lastTime > IDLE_GAP_NSEC)
+        {
+            fprintf(out, "---------------\n");
+        }
+        first = 0;
+        lastTime = CAPTURE_TIME(record);
+
+        char col[4][3] = { "  ", "  ", "  ", "  " };
+        int column = (flags & CAPTURE_RX2TX ? 2 : 0) + (flags & CAPTURE_DELIVERED ? 1 : 0);
+        snprintf(col[column], 3, "%02hhX", CAPTURE_BYTE(record));
+        fprintf(out, "%s  %s | %s  %s\n", col[0], col[1], col[2], col[3]);
+    }
+
+    free(records);
+    fclose(in);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,508 @@
+// Replay the Tx->Rx traffic of a cable capture ("log <file>") into the
+// receiver, to measure how many bytes per second the receiving stack (frame
+// parser, llread and the application layer) can take, apart from any sender.
+// As in the loopback runner, the receiver (the link layer, with the packets
+// received written to <rx file>) runs in a child process over an in-process
+// transport.
+//
+// The bytes replayed are those the receiver got in the capture (errors
+// included), from the end of the transmitter's first SET to its first DISC.
+// The replay plays the transmitter's part around them: it opens the
+// connection (SET until UA), reads the receiver's answers, and closes it
+// (DISC until DISC, then UA), so that the receiver runs to completion.
+//
+// Usage: replay [-t | -b <baud>] [-s] [-T pty|socket|shm] <capture> [<rx file>]
+//   -t  original timing of the capture
+//   -b  paced at <baud> (10 bits per byte), without the capture's idle gaps
+//       (default: as fast as the receiver takes them)
+//   -s  stop and wait for the receiver's answer after each I frame (default:
+//       stream, only counting the answers)
+//   -T  transport between the replay and the receiver (default socket)
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "frame.h"
+#include "link_layer.h"
+#include "perf_counters.h"
+#include "serial_port.h"
+#include "trace.h"
+#include "transport.h"
+
+#define N_TRIES 3
+#define TIMEOUT 4
+#define DEFAULT_BAUD_RATE 115200 // Given to the receiver when not pacing
+#define DEFAULT_BACKEND "socket"
+#define CHUNK_SIZE 4096          // Largest write, between checks for answers
+#define ANSWER_TIMEOUT_MS 200    // Wait for an answer (stop and wait, commands)
+#define COMMAND_TRIES 10
+
+enum Pacing { FAST, ORIGINAL, BAUD_RATE };
+
+// Bytes delivered to the receiver in the capture, and when
+unsigned char *bytes;
+uint64_t *times;
+long nBytes;
+
+// Frame boundaries in bytes[]
+long begin;        // After the transmitter's first SET
+long end;          // Start of its first DISC (or end of the last frame)
+long *stops;       // End of each I frame in [begin, end)
+long nStops;
+
+// Answers of the receiver
+FrameParser parser;
+unsigned char answerData[MAX_STUFFED_SIZE];
+struct
+{
+    int rr;
+    int rej;
+    int ua;
+    int disc;
+    int other;
+} answers;
+
+long long now_nsec(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// Load the bytes that left the cable towards the receiver.
+// Returns -1 on error.
+int load_capture(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+    {
+        printf("%s is not a cable capture\n", path);
+        fclose(in);
+        return -1;
+    }
+
+    // Records of a direction are in time order: no sorting needed
+    long capacity = 1 << 16;
+    bytes = malloc(capacity);
+    times = malloc(capacity * sizeof(uint64_t));
+    uint64_t chunk[4096];
+    size_t n;
+    while (bytes != NULL && times != NULL &&
+           (n = fread(chunk, sizeof(uint64_t), sizeof(chunk) / sizeof(chunk[0]), in)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint8_t flags = CAPTURE_FLAGS(chunk[i]);
+            if ((flags & (CAPTURE_RX2TX | CAPTURE_COMMAND | CAPTURE_CABLE_OFF)) != 0 ||
+                (flags & CAPTURE_DELIVERED) == 0)
+            {
+                continue;
+            }
+            if (nBytes == capacity)
+            {
+                capacity *= 2;
+                bytes = realloc(bytes, capacity);
+                times = realloc(times, capacity * sizeof(uint64_t));
+                if (bytes == NULL || times == NULL)
+                {
+                    break;
+                }
+            }
+            bytes[nBytes] = CAPTURE_BYTE(chunk[i]);
+            times[nBytes++] = CAPTURE_TIME(chunk[i]);
+        }
+    }
+    fclose(in);
+    if (bytes == NULL || times == NULL)
+    {
+        printf("Out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Find the transmitter's first SET and DISC, and the I frames in between.
+void find_frames(void)
+{
+    unsigned char data[MAX_STUFFED_SIZE];
+    FrameParser p;
+    initFrameParser(&p, data, sizeof(data));
+
+    stops = malloc((nBytes / SU_FRAME_SIZE + 1) * sizeof(long));
+    begin = -1;
+    end = -1;
+    long start = 0;
+    long last = 0;    // End of the last complete frame
+    for (long i = 0; i < nBytes && end < 0; i++)
+    {
+        int done = parseFrameByte(&p, bytes[i]);
+        if (p.state == FRAME_FLAG_RCV)
+        {
+            start = i;
+        }
+        if (!done)
+        {
+            continue;
+        }
+        last = i + 1;
+        if (p.a != SND_SNT)
+        {
+            continue;
+        }
+        if (begin < 0)
+        {
+            if (p.c == SET) begin = i + 1;
+        }
+        else if (p.c == DISC)
+        {
+            end = start;
+        }
+        else if (p.c == I(0) || p.c == I(1))
+        {
+            stops[nStops++] = i + 1;
+        }
+    }
+    if (begin < 0)
+    {
+        begin = end = 0;
+    }
+    else if (end < 0)
+    {
+        end = last; // Capture stopped during the transfer
+    }
+}
+
+void count_answer(void)
+{
+    if (parser.c == RR(0) || parser.c == RR(1)) answers.rr++;
+    else if (parser.c == REJ(0) || parser.c == REJ(1)) answers.rej++;
+    else if (parser.c == UA) answers.ua++;
+    else if (parser.c == DISC) answers.disc++;
+    else answers.other++;
+}
+
+// Read what the receiver sent, waiting at most timeoutMs milliseconds for
+// the end of a frame, which is then in "parser".
+// Returns -1 on error, 0 if no frame ended, 1 otherwise.
+int read_answer(int timeoutMs)
+{
+    long long deadline = now_nsec() + timeoutMs * 1000000LL;
+    while (TRUE)
+    {
+        long long remaining = deadline - now_nsec();
+        int ready = waitForByte(remaining > 0 ? (int) ((remaining + 999999) / 1000000) : 0);
+        if (ready <= 0)
+        {
+            return ready;
+        }
+
+        char byte;
+        int res = readByte(&byte);
+        if (res < 0)
+        {
+            return -1;
+        }
+        if (res == 1 && parseFrameByte(&parser, byte))
+        {
+            count_answer();
+            return 1;
+        }
+    }
+}
+
+int write_all(const unsigned char *buf, long size)
+{
+    while (size > 0)
+    {
+        int n = writeBytes((const char *) buf, size);
+        if (n < 0)
+        {
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Send command "c" until the receiver answers with frame "a", "answer".
+// Returns -1 on error or if no answer arrived.
+int exchange(unsigned char c, unsigned char a, unsigned char answer)
+{
+    unsigned char frame[SU_FRAME_SIZE] = {FLAG, SND_SNT, c, SND_SNT ^ c, FLAG};
+    for (int i = 0; i < COMMAND_TRIES; i++)
+    {
+        if (write_all(frame, sizeof(frame)) < 0)
+        {
+            return -1;
+        }
+        long long deadline = now_nsec() + ANSWER_TIMEOUT_MS * 1000000LL;
+        long long remaining;
+        while ((remaining = deadline - now_nsec()) > 0)
+        {
+            int res = read_answer((int) (remaining / 1000000) + 1);
+            if (res < 0)
+            {
+                return -1;
+            }
+            if (res == 1 && parser.a == a && parser.c == answer)
+            {
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr, "No answer from the receiver (command 0x%02X)\n", c);
+    return -1;
+}
+
+// Time, relative to the first byte, when byte i is due
+long long due_nsec(long i, enum Pacing pacing, int baudRate)
+{
+    switch (pacing)
+    {
+    case ORIGINAL:
+        return times[i] - times[begin];
+    case BAUD_RATE:
+        return (i - begin) * 10 * 1000000000LL / baudRate;
+    default:
+        return 0;
+    }
+}
+
+// Write bytes[begin, end), as paced, checking for answers between writes.
+// Returns -1 on error.
+int replay(enum Pacing pacing, int baudRate, int stopAndWait)
+{
+    long long start = now_nsec();
+    long stop = 0;
+    long i = begin;
+    while (i < end)
+    {
+        long n = end - i;
+        if (pacing != FAST)
+        {
+            long long due = start + due_nsec(i, pacing, baudRate);
+            struct timespec t = { .tv_sec = due / 1000000000LL, .tv_nsec = due % 1000000000LL };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+
+            // Everything due by now, if the receiver fell behind
+            long long now = now_nsec() - start;
+            n = 1;
+            while (i + n < end && n < CHUNK_SIZE && due_nsec(i + n, pacing, baudRate) <= now)
+            {
+                n++;
+            }
+        }
+        if (n > CHUNK_SIZE) n = CHUNK_SIZE;
+        if (stopAndWait && stop < nStops && i + n > stops[stop]) n = stops[stop] - i;
+
+        if (write_all(bytes + i, n) < 0)
+        {
+            return -1;
+        }
+        i += n;
+
+        int res;
+        if (stopAndWait && stop < nStops && i == stops[stop])
+        {
+            // A frame whose header was corrupted gets no answer
+            stop++;
+            res = read_answer(ANSWER_TIMEOUT_MS);
+        }
+        else
+        {
+            while ((res = read_answer(0)) == 1)
+                ;
+        }
+        if (res < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Receiver side: the link layer on its own (the application layer packets
+// are written to "filename" as received, if not NULL).
+// Returns the exit status of the child.
+int receive(const char *address, int baudRate, const char *filename)
+{
+    LinkLayer parameters = {
+        .role = LlRx,
+        .baudRate = baudRate,
+        .nRetransmissions = N_TRIES,
+        .timeout = TIMEOUT,
+    };
+    strcpy(parameters.serialPort, address);
+
+    FILE *out = NULL;
+    if (filename != NULL && (out = fopen(filename, "wb")) == NULL)
+    {
+        perror(filename);
+        return 1;
+    }
+    if (llopen(parameters) < 0)
+    {
+        return 1;
+    }
+
+    unsigned char packet[MAX_PAYLOAD_SIZE];
+    int n;
+    while ((n = llread(packet)) > 0)
+    {
+        if (out != NULL)
+        {
+            PERF_ENTER(PERF_FILE_WRITE);
+            fwrite(packet, 1, n, out);
+            PERF_EXIT();
+            TRACE_EVENT(TRACE_DISK_WRITE, n);
+        }
+    }
+    llclose(TRUE);
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+    return n < 0;
+}
+
+int main(int argc, char *argv[])
+{
+    enum Pacing pacing = FAST;
+    int baudRate = DEFAULT_BAUD_RATE;
+    int stopAndWait = FALSE;
+    const char *backend = DEFAULT_BACKEND;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "tb:sT:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            pacing = ORIGINAL;
+            break;
+        case 'b':
+            pacing = BAUD_RATE;
+            baudRate = atoi(optarg);
+            break;
+        case 's':
+            stopAndWait = TRUE;
+            break;
+        case 'T':
+            backend = optarg;
+            break;
+        default:
+            baudRate = 0;
+            break;
+        }
+    }
+    if (optind < argc - 2 || optind > argc - 1 || baudRate <= 0)
+    {
+        printf("Usage: %s [-t | -b <baud>] [-s] [-T pty|socket|shm] <capture> [<rx file>]\n"
+               "  -t  original timing of the capture\n"
+               "  -b  paced at <baud>, without the capture's idle gaps (default: as fast as possible)\n"
+               "  -s  stop and wait for the receiver's answer after each I frame\n"
+               "  -T  transport to the receiver (default %s)\n",
+               argv[0], DEFAULT_BACKEND);
+        return 1;
+    }
+    const char *rxFile = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+    if (load_capture(argv[optind]) < 0)
+    {
+        return 1;
+    }
+    find_frames();
+    if (begin == end)
+    {
+        printf("No transmitter SET followed by traffic in the capture\n");
+        return 1;
+    }
+
+    char txAddress[MAX_ADDRESS_SIZE];
+    char rxAddress[MAX_ADDRESS_SIZE];
+    if (createTransportPair(backend, txAddress, rxAddress) == -1)
+    {
+        return 2;
+    }
+
+    // Output of both sides goes to the same terminal
+    fflush(stdout);
+
+    pid_t rx = fork();
+    if (rx == -1)
+    {
+        perror("fork");
+        return 3;
+    }
+    if (rx == 0)
+    {
+        releaseTransportAddress(txAddress);
+        exit(receive(rxAddress, baudRate, rxFile));
+    }
+
+    releaseTransportAddress(rxAddress);
+    signal(SIGPIPE, SIG_IGN);
+    initFrameParser(&parser, answerData, sizeof(answerData));
+
+    int res = openSerialPort(txAddress, baudRate);
+    long long start = 0;
+    long long elapsed = 0;
+    if (res >= 0)
+    {
+        res = exchange(SET, RCV_ANS, UA);
+    }
+    if (res >= 0)
+    {
+        start = now_nsec();
+        res = replay(pacing, baudRate, stopAndWait);
+    }
+    if (res >= 0)
+    {
+        // The receiver answers DISC once it took every byte before it
+        res = exchange(DISC, RCV_SNT, DISC);
+        elapsed = now_nsec() - start;
+    }
+    if (res >= 0)
+    {
+        unsigned char ua[SU_FRAME_SIZE] = {FLAG, SND_ANS, UA, SND_ANS ^ UA, FLAG};
+        res = write_all(ua, sizeof(ua));
+    }
+    closeSerialPort();
+    if (res < 0)
+    {
+        kill(rx, SIGTERM);
+    }
+
+    int status;
+    waitpid(rx, &status, 0);
+    if (res < 0)
+    {
+        return 4;
+    }
+
+    long replayed = end - begin;
+    printf("Replayed %ld bytes (%ld I frames) in %.6f s: %.0f bytes/s (%.0f bit/s at 10 bits per byte)\n"
+           "Receiver answers: %d RR, %d REJ, %d UA, %d DISC, %d other\n",
+           replayed, nStops, elapsed / 1e9, replayed / (elapsed / 1e9), replayed * 10 / (elapsed / 1e9),
+           answers.rr, answers.rej, answers.ua, answers.disc, answers.other);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 4;
+}
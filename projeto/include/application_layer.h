@@ -9,10 +9,11 @@
 //   serialPort: Serial port name (e.g., /dev/ttyS0).
 //   role: Application role {"tx", "rx"}.
 //   baudrate: Baudrate of the serial port.
+//   maxBaudRate: Highest baudrate to negotiate on open (0 to keep baudrate).
 //   nTries: Maximum number of frame retries.
 //   timeout: Frame timeout.
 //   filename: Name of the file to send / receive.
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
-                      int nTries, int timeout, const char *filename);
+                      int maxBaudRate, int nTries, int timeout, const char *filename);
 
 #endif // _APPLICATION_LAYER_H_
@@ -0,0 +1,89 @@
+// Frame format of the link layer protocol, shared by the link layer and the
+// offline tools that decode its traffic (bin/analyzer).
+//
+//   Supervision / unnumbered:  FLAG A C BCC1 FLAG
+//   Information:               FLAG A C BCC1 D1..Dn BCC2 FLAG
+//
+// BCC1 = A ^ C, BCC2 = D1 ^ ... ^ Dn, and FLAG / ESC inside D1..Dn BCC2 are
+// sent as ESC (byte ^ ESC_XOR).
+
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include "link_layer.h"
+
+#define FLAG 0x7E
+#define SND_SNT 0x03 // Frames sent by sender
+#define RCV_ANS 0x03 // Answers from the receiver
+#define RCV_SNT 0x01 // Frames sent by receiver
+#define SND_ANS 0x01 // Answers from the sender
+#define SET 0x03
+#define UA 0x07
+#define DISC 0x0B
+
+#define I(ns) ((ns) << 7)
+#define RR(nr) (0xAA | (nr))
+#define REJ(nr) (0x54 | (nr))
+#define ESC 0x7D
+#define ESC_XOR 0x20
+
+#define BAUD 0x10 // BAUD | i proposes the i-th rate given by supportedBaudRates
+#define BAUD_MASK 0xF0
+#define PROBE 0x0F // Test frame sent at a candidate baud rate, echoed as answer
+
+// Supervision and unnumbered frames: FLAG A C BCC1 FLAG
+#define SU_FRAME_SIZE 5
+// Stuffed payload and BCC2 of an information frame
+#define MAX_STUFFED_SIZE (2 * (MAX_PAYLOAD_SIZE + 1))
+#define MAX_FRAME_SIZE (MAX_STUFFED_SIZE + SU_FRAME_SIZE)
+
+// Receiver state machine states
+enum frame_state {
+    FRAME_START,
+    FRAME_FLAG_RCV,
+    FRAME_A_RCV,
+    FRAME_C_RCV,
+    FRAME_BCC_OK,
+    FRAME_STOP
+};
+
+// Receiver state machine, fed one byte at a time. Once a frame is complete,
+// "a", "c" and the "dataSize" bytes between BCC1 and the closing flag (still
+// stuffed) describe it, until the next byte starts over.
+typedef struct {
+    enum frame_state state;
+    unsigned char a;
+    unsigned char c;
+    unsigned char *data; // At most maxDataSize bytes (frames with more are dropped)
+    int maxDataSize;
+    int dataSize;
+} FrameParser;
+
+// Start a parser waiting for the opening flag.
+void initFrameParser(FrameParser *p, unsigned char *data, int maxDataSize);
+
+// Feed the next byte received.
+// Returns 1 if the byte completed a frame, 0 otherwise.
+int parseFrameByte(FrameParser *p, unsigned char byte);
+
+// Byte stuffing of FLAG and ESC. "out" must hold 2 * size bytes.
+// Returns the stuffed size.
+int stuffBytes(const unsigned char *in, int size, unsigned char *out);
+
+// Undo byte stuffing in place.
+// Returns the destuffed size, or -1 if an escape sequence is invalid.
+int destuffBytes(unsigned char *data, int size);
+
+// XOR of "size" bytes (BCC2 of a payload).
+unsigned char blockCheck(const unsigned char *data, int size);
+
+// Build information frame I(ns) carrying "size" payload bytes (at most
+// MAX_PAYLOAD_SIZE). "frame" must hold MAX_FRAME_SIZE bytes.
+// Returns the frame size.
+int buildInformationFrame(const unsigned char *payload, int size, int ns, unsigned char *frame);
+
+// Destuff in place the data of a received information frame and check BCC2.
+// Returns the payload size, or -1 if the data is invalid.
+int decodeInformationFrame(unsigned char *data, int dataSize);
+
+#endif // _FRAME_H_
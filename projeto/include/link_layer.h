@@ -15,6 +15,7 @@ typedef struct
     char serialPort[50];
     LinkLayerRole role;
     int baudRate;
+    int maxBaudRate; // Negotiate up to this rate on llopen (0 to keep baudRate)
     int nRetransmissions;
     int timeout;
 } LinkLayer;
@@ -0,0 +1,60 @@
+// Hardware performance counters (perf_event_open) per phase of the link and
+// application layers: cycles, instructions, cache misses, CPU time and
+// context switches of this process, shown in the llclose statistics.
+//
+// Compiled in only with -DPERF_COUNTERS ("make clean && make PERF=1");
+// otherwise the macros expand to nothing. Phases nest, and each counts only
+// the time not spent in the phases nested inside it ("other" is everything
+// outside any phase). Counters the kernel or the machine does not provide
+// (virtual machines often lack hardware counters; see also
+// /proc/sys/kernel/perf_event_paranoid) show as n/a. Switching phases costs
+// a system call, which is counted in the phase being left.
+
+#ifndef _PERF_COUNTERS_H_
+#define _PERF_COUNTERS_H_
+
+typedef enum
+{
+    PERF_OTHER,      // Outside any phase
+    PERF_BUILD,      // Frame header and BCC2
+    PERF_STUFF,      // Byte stuffing
+    PERF_WRITE,      // Writing to the port, paced by its output queue
+    PERF_WAIT,       // Waiting for the output queue to drain or for bytes
+    PERF_READ,       // Reading from the port
+    PERF_PARSE,      // Frame parser state machine
+    PERF_DESTUFF,    // Destuffing and BCC2 check
+    PERF_FILE_READ,  // Application: reading the file to send
+    PERF_FILE_WRITE, // Application: writing the file received
+    PERF_PHASES
+} PerfPhase;
+
+#ifdef PERF_COUNTERS
+
+#define PERF_ENTER(phase) perfEnter(phase)
+#define PERF_EXIT() perfExit()
+#define PERF_RESET() perfReset()
+#define PERF_PRINT() perfPrint()
+
+// Enter a phase (nested in the current one), opening the counters on the
+// first call.
+void perfEnter(PerfPhase phase);
+
+// Leave the current phase.
+void perfExit(void);
+
+// Clear the figures of every phase.
+void perfReset(void);
+
+// Print the figures of every phase entered since the last reset.
+void perfPrint(void);
+
+#else
+
+#define PERF_ENTER(phase) ((void) 0)
+#define PERF_EXIT() ((void) 0)
+#define PERF_RESET() ((void) 0)
+#define PERF_PRINT() ((void) 0)
+
+#endif // PERF_COUNTERS
+
+#endif // _PERF_COUNTERS_H_
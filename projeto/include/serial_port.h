@@ -4,7 +4,12 @@
 #ifndef _SERIAL_PORT_H_
 #define _SERIAL_PORT_H_
 
-// Open and configure the serial port.
+#include <time.h>
+
+// Open and configure the serial port. The name selects the transport backend
+// (a device path, or an in-process endpoint; see transport.h). Baud rates
+// other than the standard ones need driver support for custom rates (see
+// customBaudRateSupported).
 // Returns -1 on error.
 int openSerialPort(const char *serialPort, int baudRate);
 
@@ -19,7 +24,46 @@ int readByte(char *byte);
 
 // Write up to numBytes to the serial port (must check how many were actually
 // written in the return value).
+// Paced: blocks until the driver output queue is short enough, and only
+// writes as much as keeps it within a small target depth.
 // Returns -1 on error, otherwise the number of bytes written.
 int writeBytes(const char *bytes, int numBytes);
 
+// Get the number of bytes waiting in the driver output queue.
+// Returns -1 on error.
+int outputQueueBytes();
+
+// Wait up to timeoutMs milliseconds (negative waits forever) for the driver
+// output queue to drop to maxQueued bytes or less.
+// Returns -1 on error, 0 on timeout, 1 once the queue is short enough.
+int waitOutputQueue(int maxQueued, int timeoutMs);
+
+// Wait up to timeoutMs milliseconds for a byte to be available for reading
+// (a negative timeoutMs waits forever).
+// Returns -1 on error, 0 on timeout, 1 if a byte can be read.
+int waitForByte(int timeoutMs);
+
+// Discard stale bytes left in the serial port by a previous session.
+// Returns -1 on error, otherwise the number of input bytes discarded.
+int drainSerialPort();
+
+// Get the baud rates supported by openSerialPort, in increasing order.
+// Returns the number of entries stored in *rates.
+int supportedBaudRates(const int **rates);
+
+// Change the baud rate of the open serial port, once all pending output has
+// been transmitted at the current rate.
+// Returns -1 on error.
+int setBaudRate(int baudRate);
+
+// Check whether the open serial port accepts arbitrary baud rates
+// (termios2 / BOTHER).
+// Returns 1 if it does, 0 otherwise.
+int customBaudRateSupported();
+
+// Get the current time of the serial port clock: CLOCK_MONOTONIC, or the
+// virtual clock of the cable if the CABLE_CLOCK environment variable was set
+// on open (see virtual_clock.h). Use it to time timeouts and statistics.
+void serialPortTime(struct timespec *t);
+
 #endif // _SERIAL_PORT_H_
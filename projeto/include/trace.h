@@ -0,0 +1,48 @@
+// Per-frame event tracing of the link and application layers, dumped in the
+// Chrome trace event format (open it in ui.perfetto.dev or chrome://tracing).
+//
+// Tracing is compiled in only with -DTRACE ("make clean && make TRACE=1");
+// otherwise TRACE_EVENT expands to nothing. Events go, timestamped with the
+// serial port clock (virtual time included), into a ring buffer per thread
+// holding the last TRACE_CAPACITY events. llclose dumps them when the
+// environment variable LL_TRACE names a file: both sides of a link may share
+// the file, each process appending its own events.
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#define TRACE_ENV "LL_TRACE"
+#define TRACE_CAPACITY 65536
+
+typedef enum
+{
+    TRACE_FRAME_QUEUED,   // Information frame built (value: sequence number)
+    TRACE_FRAME_WRITTEN,  // Frame handed to the port (value: control field)
+    TRACE_FRAME_DRAINED,  // Frame left the output queue (value: control field)
+    TRACE_FRAME_RECEIVED, // Frame received (value: control field)
+    TRACE_ACK,            // RR received for the frame sent (value: control field)
+    TRACE_TIMEOUT,        // Retransmission timer fired (value: timeout in usec)
+    TRACE_REJ,            // REJ received or sent (value: control field)
+    TRACE_DISK_WRITE,     // Packet written to the output file (value: bytes)
+    TRACE_EVENT_TYPES
+} TraceEventType;
+
+#ifdef TRACE
+
+#define TRACE_EVENT(type, value) traceEvent(type, value)
+
+// Record an event of the calling thread.
+void traceEvent(TraceEventType type, int value);
+
+// Append the calling thread's events to the file named by LL_TRACE (nothing
+// if it is not set), as process "processName", and clear them.
+// Returns -1 on error.
+int traceDump(const char *processName);
+
+#else
+
+#define TRACE_EVENT(type, value) ((void) 0)
+
+#endif // TRACE
+
+#endif // _TRACE_H_
@@ -0,0 +1,87 @@
+// Transport backends behind the serial port interface.
+// The address given to openSerialPort (the "serialPort" of the link layer)
+// selects the backend:
+//   /dev/ttyS10         real or virtual serial port (termios)
+//   pty:<fd>            inherited pseudo-terminal descriptor
+//   socket:<fd>         inherited socketpair descriptor
+//   shm:<name>:<side>   shared-memory ring pair <name>, side 0 or 1
+
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#define MAX_ADDRESS_SIZE 50 // Same as LinkLayer.serialPort
+
+typedef struct Transport Transport;
+
+// Operations of a backend. All return -1 on error.
+typedef struct
+{
+    const char *prefix; // Address prefix selecting the backend ("" for devices)
+
+    // Open the endpoint at "address" (without the prefix).
+    int (*open)(Transport *t, const char *address, int baudRate);
+
+    // Close the endpoint, restoring any settings changed on open.
+    int (*close)(Transport *t);
+
+    // Number of bytes that can be read without blocking.
+    int (*readable)(Transport *t);
+
+    // Read up to numBytes, blocking until at least one is available.
+    int (*read)(Transport *t, char *bytes, int numBytes);
+
+    // Write up to numBytes, returning how many were accepted.
+    int (*write)(Transport *t, const char *bytes, int numBytes);
+
+    // Wait up to timeoutMs milliseconds (negative waits forever) for bytes to
+    // read. Returns -1 on error or if the other side hung up, 0 on timeout,
+    // 1 if bytes (or the end of file) can be read.
+    int (*wait)(Transport *t, int timeoutMs);
+
+    // Change the baud rate once pending output was sent (NULL if the backend
+    // has no notion of baud rate).
+    int (*setBaudRate)(Transport *t, int baudRate);
+
+    // Bytes waiting in the output queue (NULL if the backend has none).
+    int (*outputQueue)(Transport *t);
+
+    // Whether arbitrary baud rates are accepted (NULL if the backend has no
+    // notion of baud rate).
+    int (*customBaudRate)(Transport *t);
+} TransportOps;
+
+// An open endpoint
+struct Transport
+{
+    const TransportOps *ops;
+    int fd;        // Descriptor, for backends that have one (-1 otherwise)
+    void *state;   // Backend private state
+    int baudRate;
+};
+
+extern const TransportOps ttyTransport;
+extern const TransportOps ptyTransport;
+extern const TransportOps socketTransport;
+extern const TransportOps shmTransport;
+
+// Find the backend for "address", storing in *rest the address without the
+// backend prefix.
+// Returns NULL if the prefix is unknown.
+const TransportOps *findTransport(const char *address, const char **rest);
+
+// Create a connected pair of endpoints for the in-process backends ("pty",
+// "socket" or "shm"). The addresses to open on each side are stored in
+// addressA and addressB (MAX_ADDRESS_SIZE bytes each). Descriptors are
+// inherited by child processes, so each side can run after a fork.
+// Returns -1 on error.
+int createTransportPair(const char *backend, char *addressA, char *addressB);
+
+// Close the inherited descriptor behind an address from createTransportPair,
+// for the process that does not use that side.
+void releaseTransportAddress(const char *address);
+
+// Create a fresh shared memory object, storing its name in "name".
+// Returns -1 on error.
+int createShmChannel(char *name, int size);
+
+#endif // _TRANSPORT_H_
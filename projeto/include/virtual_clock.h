@@ -0,0 +1,59 @@
+// Virtual clock shared with the cable program ("cable -v <socket>").
+// In virtual time, the cable advances the clock only when every program
+// attached to it is blocked waiting for bytes or for a deadline, jumping
+// straight to the next event; long, slow transfers then take as long as the
+// computation they need, with the same timing results.
+//
+// A program attaches by setting the environment variable CABLE_CLOCK to the
+// cable's clock socket before opening the serial port.
+
+#ifndef _VIRTUAL_CLOCK_H_
+#define _VIRTUAL_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define CLOCK_ENV "CABLE_CLOCK"
+
+// Messages exchanged over the clock socket (fixed size, host byte order)
+enum
+{
+    CLOCK_HELLO, // Attach to the clock of port "port" (program to cable)
+    CLOCK_WAIT,  // Blocked until bytes arrive or until "time" (program to cable)
+    CLOCK_WAKE   // Resume at "time" (cable to program)
+};
+
+typedef struct
+{
+    int32_t type;
+    int32_t reserved;
+    int64_t time;      // Virtual time (nsec); WAIT: deadline, or -1 for none
+    int64_t written;   // WAIT: bytes written to the port since attaching
+    int64_t read;      // WAIT: bytes read from the port since attaching
+    int64_t delivered; // WAKE: bytes delivered to the port since attaching
+    char port[64];     // HELLO: path of the pseudo-terminal (resolved)
+} ClockMessage;
+
+// Attach to the virtual clock at "socketPath", for the serial port "port".
+// Returns -1 on error.
+int clockAttach(const char *socketPath, const char *port);
+
+// Detach from the virtual clock.
+void clockDetach();
+
+// Check whether the virtual clock is in use.
+// Returns 1 if it is, 0 otherwise.
+int clockAttached();
+
+// Get the current virtual time.
+void clockTime(struct timespec *t);
+
+// Block until bytes not read yet are delivered to the port, or timeoutMs
+// milliseconds of virtual time elapse (negative waits for bytes only).
+// "written" and "read" count the bytes written to and read from the port
+// since attaching; the number of bytes delivered since attaching is stored
+// in *delivered.
+// Returns -1 on error, 0 otherwise.
+int clockWait(int timeoutMs, int64_t written, int64_t read, int64_t *delivered);
+
+#endif // _VIRTUAL_CLOCK_H_
@@ -0,0 +1,61 @@
+// Loopback runner: transmitter and receiver of the serial port project over
+// an in-process transport (no serial ports, socat or virtual cable needed).
+// The receiver runs in a child process.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "application_layer.h"
+#include "transport.h"
+
+#define N_TRIES 3
+#define TIMEOUT 4
+
+// Arguments:
+//   $1: pty | socket | shm
+//   $2: baud rate
+//   $3: file to send
+//   $4: file to receive
+int main(int argc, char *argv[])
+{
+    if (argc < 5) {
+        printf("Usage: %s pty|socket|shm baudrate txfile rxfile\n", argv[0]);
+        exit(1);
+    }
+
+    const char *backend = argv[1];
+    const int baudrate = atoi(argv[2]);
+    const char *txFile = argv[3];
+    const char *rxFile = argv[4];
+
+    char txAddress[MAX_ADDRESS_SIZE];
+    char rxAddress[MAX_ADDRESS_SIZE];
+    if (createTransportPair(backend, txAddress, rxAddress) == -1) {
+        exit(2);
+    }
+
+    // Output of both sides goes to the same terminal
+    fflush(stdout);
+
+    pid_t rx = fork();
+    if (rx == -1) {
+        perror("fork");
+        exit(3);
+    }
+    if (rx == 0) {
+        releaseTransportAddress(txAddress);
+        applicationLayer(rxAddress, "rx", baudrate, 0, N_TRIES, TIMEOUT, rxFile);
+        exit(0);
+    }
+
+    releaseTransportAddress(rxAddress);
+    applicationLayer(txAddress, "tx", baudrate, 0, N_TRIES, TIMEOUT, txFile);
+
+    int status;
+    waitpid(rx, &status, 0);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 4;
+}
@@ -10,16 +10,27 @@
 #define N_TRIES 3
 #define TIMEOUT 4
 
+#define MIN_BAUDRATE 1200
+#define MAX_BAUDRATE 4000000
+
+// Whether the baud rate can be requested. Rates other than 1200, 1800, 2400,
+// 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800 and 921600 need
+// driver support for custom rates, which is checked when opening the port.
+static int validBaudrate(int baudrate)
+{
+    return baudrate >= MIN_BAUDRATE && baudrate <= MAX_BAUDRATE;
+}
 
 // Arguments:
 //   $1: /dev/ttySxx
 //   $2: baud rate
 //   $3: tx | rx
 //   $4: filename
+//   $5: maximum baud rate to negotiate (optional)
 int main(int argc, char *argv[])
 {
     if (argc < 5) {
-        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename\n", argv[0]);
+        printf("Usage: %s /dev/ttySxx baudrate tx|rx filename [maxbaudrate]\n", argv[0]);
         exit(1);
     }
 
@@ -27,22 +38,12 @@ int main(int argc, char *argv[])
     const int baudrate = atoi(argv[2]);
     const char *role = argv[3];
     const char *filename = argv[4];
+    const int maxBaudrate = argc > 5 ? atoi(argv[5]) : 0;
 
-    // Validate baud rate
-    switch (baudrate) {
-        case 1200:
-        case 1800:
-        case 2400:
-        case 4800:
-        case 9600:
-        case 19200:
-        case 38400:
-        case 57600:
-        case 115200:
-            break;
-        default:
-            printf("Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
-            exit(2);
+    // Validate baud rates
+    if (!validBaudrate(baudrate) || (maxBaudrate != 0 && !validBaudrate(maxBaudrate))) {
+        printf("Unsupported baud rate (must be between %d and %d)\n", MIN_BAUDRATE, MAX_BAUDRATE);
+        exit(2);
     }
 
     // Validate role
@@ -55,17 +56,19 @@ int main(int argc, char *argv[])
            "  - Serial port: %s\n"
            "  - Role: %s\n"
            "  - Baudrate: %d\n"
+           "  - Max baudrate: %d\n"
            "  - Number of tries: %d\n"
            "  - Timeout: %d\n"
            "  - Filename: %s\n",
            serialPort,
            role,
            baudrate,
+           maxBaudrate,
            N_TRIES,
            TIMEOUT,
            filename);
 
-    applicationLayer(serialPort, role, baudrate, N_TRIES, TIMEOUT, filename);
+    applicationLayer(serialPort, role, baudrate, maxBaudrate, N_TRIES, TIMEOUT, filename);
 
     return 0;
 }
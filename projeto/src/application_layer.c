@@ -1,11 +1,742 @@
 // Application layer protocol implementation
+//
+// Packets (several may share one link layer frame, so that small files go
+// back to back instead of costing a frame each):
+//   data     C_DATA N2 N1 L2 L1 <data>      N: sequence number, modulo 65536
+//   control  C_START|C_END L2 L1 <TLVs>     each TLV: T L <V>
+//
+// Numbers in TLVs are big endian, in as many bytes as needed (up to 8, so
+// sizes are 64-bit). Every file goes between a START and an END packet
+// carrying its size, mode and modification time; START also carries its
+// name, and END the digest of the data (all optional but the size in END).
+// The receiver preallocates files whose size is known from START. The
+// transmitter sends a single file, a directory tree, or the files listed in
+// "@<list file>" (one path per line), all in one link layer session. The
+// receiver writes a single file to the given name, and a batch below the
+// directory of that name.
+//
+// The name "-" streams standard input (tx) to standard output (rx): START
+// then has no size (nor name, mode or time), which only END gives. Messages
+// that would go to standard output go to standard error instead.
+
+#define _GNU_SOURCE // fallocate
 
 #include "application_layer.h"
 #include "link_layer.h"
+#include "perf_counters.h"
+#include "serial_port.h"
 #include "string.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Packet types
+#define C_DATA 1
+#define C_START 2
+#define C_END 3
+
+// TLV types of the control packets
+#define T_SIZE 0   // File size in bytes
+#define T_NAME 1   // Name of a single file sent (informative)
+#define T_MODE 2   // File type and permissions (st_mode)
+#define T_PATH 3   // Path of a file in a batch, relative to the receiver's directory
+#define T_DIGEST 4 // CRC-32 of the file data (END only)
+#define T_MTIME 5  // Modification time (seconds since the epoch)
+
+#define STDIO_NAME "-"
+
+#define DATA_HEADER_SIZE 5
+#define MIN_DATA_SIZE 64    // Start a new frame rather than send less data
+#define MAX_NAME_SIZE 255
+#define MAX_CONTROL_SIZE (3 + 4 * 10 + 2 + MAX_NAME_SIZE)
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+// Contents of the control packets (fields present in the has* bit mask)
+typedef struct {
+    int has;
+    uint64_t size;
+    uint32_t mode;
+    int64_t mtime;
+    uint32_t digest;
+    char name[MAX_NAME_SIZE + 1];
+    int isPath; // Name given by T_PATH (batch transfer)
+} FileInfo;
+
+#define HAS(t) (1 << (t))
+
+static struct {
+    int files;
+    int directories;
+    uint64_t bytes;
+} totals;
+
+////////////////////////////////////////////////
+// PACKETS
+////////////////////////////////////////////////
+
+// CRC-32 (IEEE 802.3) of "size" bytes, continuing from "crc" (0 to start).
+static uint32_t crc32_update(uint32_t crc, const unsigned char *data, int size)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+    }
+
+    crc ^= 0xFFFFFFFF;
+    for (int i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+// Append a TLV holding a number, in as few bytes as it needs.
+// Returns the TLV size.
+static int put_number(unsigned char *p, unsigned char t, uint64_t value)
+{
+    int l = 1;
+    while (l < 8 && value >> (8 * l) != 0) l++;
+
+    p[0] = t;
+    p[1] = l;
+    for (int i = 0; i < l; i++) {
+        p[2 + i] = value >> (8 * (l - 1 - i));
+    }
+    return 2 + l;
+}
+
+static uint64_t get_number(const unsigned char *v, int l)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < l; i++) {
+        value = value << 8 | v[i];
+    }
+    return value;
+}
+
+// Build a START or END packet.
+// Returns its size.
+static int build_control_packet(unsigned char c, const FileInfo *info, unsigned char *packet)
+{
+    int size = 3;
+    if (info->has & HAS(T_SIZE)) size += put_number(packet + size, T_SIZE, info->size);
+    if (info->has & HAS(T_MODE)) size += put_number(packet + size, T_MODE, info->mode);
+    if (info->has & HAS(T_MTIME)) size += put_number(packet + size, T_MTIME, info->mtime);
+
+    if (c == C_START && info->has & HAS(T_NAME)) {
+        int nameSize = strlen(info->name);
+        packet[size++] = info->isPath ? T_PATH : T_NAME;
+        packet[size++] = nameSize;
+        memcpy(packet + size, info->name, nameSize);
+        size += nameSize;
+    }
+    if (c == C_END && info->has & HAS(T_DIGEST)) {
+        size += put_number(packet + size, T_DIGEST, info->digest);
+    }
+
+    packet[0] = c;
+    packet[1] = (size - 3) >> 8;
+    packet[2] = (size - 3) & 0xFF;
+    return size;
+}
+
+// Read the TLVs of a control packet.
+// Returns -1 if they are malformed.
+static int parse_control_packet(const unsigned char *tlv, int size, FileInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    int pos = 0;
+    while (pos < size) {
+        if (pos + 2 > size || pos + 2 + tlv[pos + 1] > size) {
+            return -1;
+        }
+        unsigned char t = tlv[pos];
+        unsigned char l = tlv[pos + 1];
+        const unsigned char *v = tlv + pos + 2;
+
+        int isNumber = t == T_SIZE || t == T_MODE || t == T_DIGEST || t == T_MTIME;
+        if (isNumber && (l == 0 || l > 8)) {
+            return -1;
+        }
+        uint64_t value = isNumber ? get_number(v, l) : 0;
+
+        if (t == T_SIZE) info->size = value;
+        else if (t == T_MODE) info->mode = value;
+        else if (t == T_MTIME) info->mtime = value;
+        else if (t == T_DIGEST) info->digest = value;
+        else if (t == T_NAME || t == T_PATH) {
+            memcpy(info->name, v, l);
+            info->name[l] = '\0';
+            info->isPath = t == T_PATH;
+            t = T_NAME;
+        }
+        // Unknown types are skipped
+        if (t < 8 * sizeof(info->has)) info->has |= HAS(t);
+        pos += 2 + l;
+    }
+    return 0;
+}
+
+////////////////////////////////////////////////
+// TRANSMITTER
+////////////////////////////////////////////////
+
+// Frame being filled with packets
+static unsigned char frame[MAX_PAYLOAD_SIZE];
+static int frameSize = 0;
+
+// Send the packets gathered so far.
+// Returns -1 on error.
+static int flush_frame(void)
+{
+    if (frameSize > 0 && llwrite(frame, frameSize) != frameSize) {
+        return -1;
+    }
+    frameSize = 0;
+    return 0;
+}
+
+// Make room for "size" bytes of packets in the frame, sending it if needed.
+// Returns -1 on error.
+static int reserve(int size)
+{
+    if (frameSize + size > MAX_PAYLOAD_SIZE) {
+        return flush_frame();
+    }
+    return 0;
+}
+
+static int send_control_packet(unsigned char c, const FileInfo *info)
+{
+    unsigned char packet[MAX_CONTROL_SIZE];
+    int size = build_control_packet(c, info, packet);
+    if (reserve(size) < 0) {
+        return -1;
+    }
+    memcpy(frame + frameSize, packet, size);
+    frameSize += size;
+    return 0;
+}
+
+// Send a file or an (empty) directory entry between START and END packets,
+// or standard input if "st" is NULL.
+// Returns -1 on error.
+static int send_entry(const char *path, const char *name, int isPath, const struct stat *st)
+{
+    FileInfo info = { .isPath = isPath };
+    if (st != NULL) {
+        info.has = HAS(T_SIZE) | HAS(T_MODE) | HAS(T_MTIME) | HAS(T_NAME);
+        info.size = S_ISREG(st->st_mode) ? st->st_size : 0;
+        info.mode = st->st_mode;
+        info.mtime = st->st_mtime;
+        if (strlen(name) > MAX_NAME_SIZE) {
+            printf("ERROR: Name too long: %s\n", name);
+            return -1;
+        }
+        strcpy(info.name, name);
+    }
+
+    FILE *in = st == NULL ? stdin : NULL;
+    if (st != NULL && S_ISREG(st->st_mode) && (in = fopen(path, "rb")) == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    int res = send_control_packet(C_START, &info);
+    uint16_t n = 0;
+    uint64_t sent = 0;
+    while (res == 0 && in != NULL) {
+        // Fill the rest of the frame, unless only a few bytes would fit
+        if (MAX_PAYLOAD_SIZE - frameSize < DATA_HEADER_SIZE + MIN_DATA_SIZE && flush_frame() < 0) {
+            res = -1;
+            break;
+        }
+        unsigned char *packet = frame + frameSize;
+        PERF_ENTER(PERF_FILE_READ);
+        int size = fread(packet + DATA_HEADER_SIZE, 1, MAX_PAYLOAD_SIZE - frameSize - DATA_HEADER_SIZE, in);
+        PERF_EXIT();
+        if (size <= 0) {
+            break;
+        }
+        packet[0] = C_DATA;
+        packet[1] = n >> 8;
+        packet[2] = n & 0xFF;
+        packet[3] = size >> 8;
+        packet[4] = size & 0xFF;
+        n++;
+        info.digest = crc32_update(info.digest, packet + DATA_HEADER_SIZE, size);
+        frameSize += DATA_HEADER_SIZE + size;
+        sent += size;
+    }
+    if (in != NULL) {
+        if (ferror(in)) {
+            perror(path);
+            res = -1;
+        }
+        if (in != stdin) fclose(in);
+    }
+    if (res == 0 && info.has & HAS(T_SIZE) && sent != info.size) {
+        printf("ERROR: %s changed while being sent\n", path);
+        res = -1;
+    }
+    if (res == 0) {
+        info.size = sent;
+        info.has |= HAS(T_SIZE);
+        if (in != NULL) info.has |= HAS(T_DIGEST);
+        res = send_control_packet(C_END, &info);
+    }
+
+    if (st != NULL && S_ISDIR(st->st_mode)) totals.directories++;
+    else totals.files++;
+    totals.bytes += sent;
+    return res;
+}
+
+// Send "path" under "name": a file, or a directory and everything below it.
+// Other kinds of files are skipped.
+// Returns -1 on error.
+static int send_tree(const char *path, const char *name)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+        printf("Skipping %s (not a regular file or directory)\n", path);
+        return 0;
+    }
+    if (name[0] != '\0' && send_entry(path, name, TRUE, &st) < 0) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+
+    // In name order, so that transfers are repeatable
+    struct dirent **entries;
+    int n = scandir(path, &entries, NULL, alphasort);
+    if (n < 0) {
+        perror(path);
+        return -1;
+    }
+    int res = 0;
+    for (int i = 0; i < n; i++) {
+        const char *entry = entries[i]->d_name;
+        if (res == 0 && strcmp(entry, ".") != 0 && strcmp(entry, "..") != 0) {
+            char childPath[4096];
+            char childName[MAX_NAME_SIZE + 2];
+            snprintf(childPath, sizeof(childPath), "%s/%s", path, entry);
+            if (snprintf(childName, sizeof(childName), "%s%s%s", name,
+                         name[0] != '\0' ? "/" : "", entry) > MAX_NAME_SIZE) {
+                printf("ERROR: Name too long: %s\n", childPath);
+                res = -1;
+            }
+            else {
+                res = send_tree(childPath, childName);
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return res;
+}
+
+// Send the files and directories listed in "listFile", one per line, under
+// their relative paths (a leading "/" or "./" is dropped).
+// Returns -1 on error.
+static int send_list(const char *listFile)
+{
+    FILE *list = fopen(listFile, "r");
+    if (list == NULL) {
+        perror(listFile);
+        return -1;
+    }
+
+    char line[4096];
+    int res = 0;
+    while (res == 0 && fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') continue;
+
+        const char *name = line;
+        while (name[0] == '/' || (name[0] == '.' && name[1] == '/')) {
+            name += name[0] == '/' ? 1 : 2;
+        }
+        res = send_tree(line, name);
+    }
+    fclose(list);
+    return res;
+}
+
+static int transmit(const char *filename)
+{
+    if (filename[0] == '@') {
+        return send_list(filename + 1);
+    }
+    if (strcmp(filename, STDIO_NAME) == 0) {
+        return send_entry(STDIO_NAME, NULL, FALSE, NULL);
+    }
+
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        perror(filename);
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        return send_tree(filename, "");
+    }
+
+    const char *base = strrchr(filename, '/');
+    return send_entry(filename, base != NULL ? base + 1 : filename, FALSE, &st);
+}
+
+////////////////////////////////////////////////
+// RECEIVER
+////////////////////////////////////////////////
+
+// Check that a path received stays below the receiver's directory.
+static int safe_path(const char *path)
+{
+    if (path[0] == '\0' || path[0] == '/') {
+        return FALSE;
+    }
+    for (const char *p = path; p != NULL; p = strchr(p, '/')) {
+        if (*p == '/') p++;
+        if (strncmp(p, "..", 2) == 0 && (p[2] == '/' || p[2] == '\0')) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Create the directories leading to "path".
+static int make_parents(char *path)
+{
+    for (char *p = strchr(path + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int res = mkdir(path, 0755);
+        *p = '/';
+        if (res != 0 && errno != EEXIST) {
+            perror(path);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// File being received
+static struct {
+    FileInfo info;
+    char path[4096];
+    FILE *out;
+    int open;          // Between START and END
+    uint16_t n;        // Next data packet expected
+    uint64_t received;
+    uint32_t digest;
+    int batch;         // Directory for the batch created
+} current;
+
+// Standard output, when receiving to STDIO_NAME
+static FILE *stdioOut = NULL;
+
+// Directories received, whose mode and time are set only once the batch is
+// over: the files written into a directory would change its time, and its
+// mode could forbid writing them
+typedef struct {
+    char *path;
+    int depth;
+    FileInfo info;
+} DirectoryInfo;
+
+static struct {
+    DirectoryInfo *list;
+    int count;
+    int capacity;
+} directories;
+
+static int add_directory(const char *path, const FileInfo *info)
+{
+    if (directories.count == directories.capacity) {
+        int capacity = directories.capacity > 0 ? 2 * directories.capacity : 64;
+        DirectoryInfo *list = realloc(directories.list, capacity * sizeof(DirectoryInfo));
+        if (list == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        directories.list = list;
+        directories.capacity = capacity;
+    }
+
+    DirectoryInfo *d = &directories.list[directories.count];
+    d->path = strdup(path);
+    if (d->path == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    d->depth = 0;
+    for (const char *p = path; *p != '\0'; p++) {
+        if (*p == '/') d->depth++;
+    }
+    d->info = *info;
+    directories.count++;
+    return 0;
+}
+
+static int deeper_first(const void *a, const void *b)
+{
+    return ((const DirectoryInfo *) b)->depth - ((const DirectoryInfo *) a)->depth;
+}
+
+// Set the mode and time of the directories received, deepest first, so that
+// a directory's mode never keeps those below it from being changed.
+static void set_directory_info(void)
+{
+    qsort(directories.list, directories.count, sizeof(DirectoryInfo), deeper_first);
+    for (int i = 0; i < directories.count; i++) {
+        const DirectoryInfo *d = &directories.list[i];
+        if (d->info.has & HAS(T_MODE) && chmod(d->path, d->info.mode & 07777) != 0) {
+            perror(d->path);
+        }
+        if (d->info.has & HAS(T_MTIME)) {
+            struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, {.tv_sec = d->info.mtime}};
+            if (utimensat(AT_FDCWD, d->path, times, 0) != 0) perror(d->path);
+        }
+        free(d->path);
+    }
+    free(directories.list);
+    memset(&directories, 0, sizeof(directories));
+}
+
+static int start_file(const FileInfo *info, const char *filename)
+{
+    if (current.open) {
+        printf("ERROR: START of %s before the END of %s\n", info->name, current.info.name);
+        return -1;
+    }
+    if (info->isPath && stdioOut != NULL) {
+        printf("ERROR: Cannot write a batch to standard output\n");
+        return -1;
+    }
+    if (info->isPath) {
+        if (!safe_path(info->name)) {
+            printf("ERROR: Unsafe path received: %s\n", info->name);
+            return -1;
+        }
+        if (!current.batch && mkdir(filename, 0755) != 0 && errno != EEXIST) {
+            perror(filename);
+            return -1;
+        }
+        current.batch = TRUE;
+        snprintf(current.path, sizeof(current.path), "%s/%s", filename, info->name);
+        if (make_parents(current.path) < 0) {
+            return -1;
+        }
+    }
+    else {
+        snprintf(current.path, sizeof(current.path), "%s", filename);
+    }
+
+    current.info = *info;
+    current.out = NULL;
+    current.open = TRUE;
+    current.n = 0;
+    current.received = 0;
+    current.digest = 0;
+
+    if (info->has & HAS(T_MODE) && S_ISDIR(info->mode)) {
+        if (mkdir(current.path, 0755) != 0 && errno != EEXIST) {
+            perror(current.path);
+            return -1;
+        }
+        return 0;
+    }
+    if (stdioOut != NULL) {
+        current.out = stdioOut;
+        return 0;
+    }
+
+    current.out = fopen(current.path, "wb");
+    if (current.out == NULL) {
+        perror(current.path);
+        return -1;
+    }
+    setvbuf(current.out, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    // Reserve the space now, so that it is contiguous and a full disk shows
+    // before the transfer (the size grows only as data is written)
+    if (info->has & HAS(T_SIZE) && info->size > 0 &&
+        fallocate(fileno(current.out), FALLOC_FL_KEEP_SIZE, 0, info->size) != 0 &&
+        errno == ENOSPC) {
+        perror(current.path);
+        return -1;
+    }
+    return 0;
+}
+
+static int end_file(const FileInfo *info)
+{
+    if (!current.open) {
+        printf("ERROR: END without START\n");
+        return -1;
+    }
+    current.open = FALSE;
+
+    int res = 0;
+    if (current.out == stdioOut) {
+        if (current.out != NULL && fflush(current.out) != 0) {
+            perror(STDIO_NAME);
+            res = -1;
+        }
+    }
+    else if (current.out != NULL && fclose(current.out) != 0) {
+        perror(current.path);
+        res = -1;
+    }
+    uint64_t expected = info->has & HAS(T_SIZE) ? info->size : current.info.size;
+    if (!(info->has & HAS(T_SIZE)) || current.received != info->size ||
+        (current.info.has & HAS(T_SIZE) && current.received != current.info.size)) {
+        printf("ERROR: %s: received %" PRIu64 " bytes, expected %" PRIu64 "\n",
+               current.path, current.received, expected);
+        res = -1;
+    }
+    if (info->has & HAS(T_DIGEST) && current.digest != info->digest) {
+        printf("ERROR: %s: digest %08" PRIX32 ", expected %08" PRIX32 "\n",
+               current.path, current.digest, info->digest);
+        res = -1;
+    }
+
+    int isDirectory = current.info.has & HAS(T_MODE) && S_ISDIR(current.info.mode);
+    if (isDirectory && stdioOut == NULL) {
+        if (add_directory(current.path, &current.info) < 0) res = -1;
+    }
+    else if (stdioOut == NULL && current.info.has & HAS(T_MODE) &&
+             chmod(current.path, current.info.mode & 07777) != 0) {
+        perror(current.path);
+    }
+    if (!isDirectory && stdioOut == NULL && current.info.has & HAS(T_MTIME)) {
+        struct timespec times[2] = {{.tv_nsec = UTIME_OMIT}, {.tv_sec = current.info.mtime}};
+        if (utimensat(AT_FDCWD, current.path, times, 0) != 0) perror(current.path);
+    }
+
+    if (isDirectory) totals.directories++;
+    else totals.files++;
+    totals.bytes += current.received;
+    if (current.info.isPath) {
+        printf("Received %s (%" PRIu64 " bytes)\n", current.info.name, current.received);
+    }
+    return res;
+}
+
+static int write_data(uint16_t n, const unsigned char *data, int size)
+{
+    if (!current.open || current.out == NULL) {
+        printf("ERROR: Data packet outside a file\n");
+        return -1;
+    }
+    if (n != current.n) {
+        printf("ERROR: Data packet %d received, %d expected\n", n, current.n);
+        return -1;
+    }
+    current.n++;
+    current.digest = crc32_update(current.digest, data, size);
+    PERF_ENTER(PERF_FILE_WRITE);
+    size_t written = fwrite(data, 1, size, current.out);
+    PERF_EXIT();
+    TRACE_EVENT(TRACE_DISK_WRITE, size);
+    if (written != (size_t) size) {
+        perror(current.path);
+        return -1;
+    }
+    current.received += size;
+    return 0;
+}
+
+// Handle the packets of a frame.
+// Returns -1 on error.
+static int receive_packets(const unsigned char *packets, int size, const char *filename)
+{
+    int pos = 0;
+    while (pos < size) {
+        unsigned char c = packets[pos];
+        int headerSize = c == C_DATA ? DATA_HEADER_SIZE : 3;
+        if (pos + headerSize > size) {
+            printf("ERROR: Truncated packet\n");
+            return -1;
+        }
+        const unsigned char *header = packets + pos;
+        int length = header[headerSize - 2] << 8 | header[headerSize - 1];
+        const unsigned char *body = header + headerSize;
+        if (pos + headerSize + length > size) {
+            printf("ERROR: Truncated packet\n");
+            return -1;
+        }
+
+        FileInfo info;
+        int res;
+        if (c == C_DATA) {
+            res = write_data(header[1] << 8 | header[2], body, length);
+        }
+        else if (c == C_START || c == C_END) {
+            res = parse_control_packet(body, length, &info);
+            if (res < 0) printf("ERROR: Malformed control packet\n");
+            else if (c == C_START) res = start_file(&info, filename);
+            else res = end_file(&info);
+        }
+        else {
+            printf("ERROR: Unknown packet type %d\n", c);
+            res = -1;
+        }
+        if (res < 0) {
+            return -1;
+        }
+        pos += headerSize + length;
+    }
+    return 0;
+}
+
+static int receive(const char *filename)
+{
+    unsigned char packets[MAX_PAYLOAD_SIZE];
+    int size;
+
+    int res = 0;
+
+    memset(&current, 0, sizeof(current));
+    while (res == 0 && (size = llread(packets)) > 0) {
+        res = receive_packets(packets, size, filename);
+    }
+
+    if (res == 0 && size < 0) {
+        res = -1;
+    }
+    if (res == 0 && current.open) {
+        printf("ERROR: Connection closed in the middle of %s\n", current.path);
+        res = -1;
+    }
+    set_directory_info();
+    return res;
+}
+
+////////////////////////////////////////////////
+// APPLICATION LAYER
+////////////////////////////////////////////////
 
 void applicationLayer(const char *serialPort, const char *role, int baudRate,
-                      int nTries, int timeout, const char *filename)
+                      int maxBaudRate, int nTries, int timeout, const char *filename)
 {
     // Initializing LinkLayer struct
     LinkLayer layerInformation;
@@ -18,9 +749,51 @@ void applicationLayer(const char *serialPort, const char *role, int baudRate,
         layerInformation.role = LlRx;
     }
     layerInformation.baudRate = baudRate;
+    layerInformation.maxBaudRate = maxBaudRate;
     layerInformation.nRetransmissions = nTries;
     layerInformation.timeout = timeout;
-    
+
+    // Data to standard output: the rest of the output (including what is
+    // still buffered) goes to standard error
+    if (layerInformation.role == LlRx && strcmp(filename, STDIO_NAME) == 0) {
+        int dataFd = dup(STDOUT_FILENO);
+        if (dataFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+            (stdioOut = fdopen(dataFd, "wb")) == NULL) {
+            perror(STDIO_NAME);
+            return;
+        }
+    }
+
     // Open link layer
-    llopen(layerInformation);
+    if (llopen(layerInformation) < 0) {
+        printf("ERROR: Could not open the connection\n");
+        return;
+    }
+
+    struct timespec start, end;
+    serialPortTime(&start);
+    memset(&totals, 0, sizeof(totals));
+
+    int res;
+    if (layerInformation.role == LlTx) {
+        res = transmit(filename);
+        if (res == 0 && flush_frame() < 0) res = -1;
+    }
+    else {
+        res = receive(filename);
+    }
+
+    serialPortTime(&end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s %d files, %d directories, %" PRIu64 " bytes in %.3f s%s\n",
+           layerInformation.role == LlTx ? "Sent" : "Received",
+           totals.files, totals.directories, totals.bytes, seconds,
+           res < 0 ? " (transfer failed)" : "");
+
+    // Close link layer
+    llclose(TRUE);
+    if (stdioOut != NULL) {
+        fclose(stdioOut);
+        stdioOut = NULL;
+    }
 }
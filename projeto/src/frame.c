@@ -0,0 +1,121 @@
+// Frame format of the link layer protocol (see frame.h)
+
+#include "frame.h"
+#include "perf_counters.h"
+
+void initFrameParser(FrameParser *p, unsigned char *data, int maxDataSize)
+{
+    p->state = FRAME_START;
+    p->a = 0;
+    p->c = 0;
+    p->data = data;
+    p->maxDataSize = maxDataSize;
+    p->dataSize = 0;
+}
+
+int parseFrameByte(FrameParser *p, unsigned char byte)
+{
+    switch (p->state) {
+        case FRAME_START:
+        case FRAME_STOP:
+            p->state = byte == FLAG ? FRAME_FLAG_RCV : FRAME_START;
+            break;
+        case FRAME_FLAG_RCV:
+            if (byte == SND_SNT || byte == RCV_SNT) {
+                p->a = byte;
+                p->state = FRAME_A_RCV;
+            }
+            else if (byte != FLAG) p->state = FRAME_START;
+            break;
+        case FRAME_A_RCV:
+            if (byte == FLAG) p->state = FRAME_FLAG_RCV;
+            else {
+                p->c = byte;
+                p->state = FRAME_C_RCV;
+            }
+            break;
+        case FRAME_C_RCV:
+            if (byte == (p->a ^ p->c)) {
+                p->dataSize = 0;
+                p->state = FRAME_BCC_OK;
+            }
+            else if (byte == FLAG) p->state = FRAME_FLAG_RCV;
+            else p->state = FRAME_START;
+            break;
+        case FRAME_BCC_OK:
+            if (byte == FLAG) {
+                p->state = FRAME_STOP;
+                return 1;
+            }
+            if (p->dataSize < p->maxDataSize) p->data[p->dataSize++] = byte;
+            else p->state = FRAME_START;
+            break;
+    }
+    return 0;
+}
+
+int stuffBytes(const unsigned char *in, int size, unsigned char *out)
+{
+    int j = 0;
+    for (int i = 0; i < size; i++) {
+        if (in[i] == FLAG || in[i] == ESC) {
+            out[j++] = ESC;
+            out[j++] = in[i] ^ ESC_XOR;
+        }
+        else {
+            out[j++] = in[i];
+        }
+    }
+    return j;
+}
+
+int destuffBytes(unsigned char *data, int size)
+{
+    int j = 0;
+    for (int i = 0; i < size; i++) {
+        if (data[i] == ESC) {
+            if (++i == size) {
+                return -1;
+            }
+            data[j++] = data[i] ^ ESC_XOR;
+        }
+        else {
+            data[j++] = data[i];
+        }
+    }
+    return j;
+}
+
+unsigned char blockCheck(const unsigned char *data, int size)
+{
+    unsigned char bcc = 0;
+    for (int i = 0; i < size; i++) {
+        bcc ^= data[i];
+    }
+    return bcc;
+}
+
+int buildInformationFrame(const unsigned char *payload, int size, int ns, unsigned char *frame)
+{
+    unsigned char bcc2 = blockCheck(payload, size);
+    frame[0] = FLAG;
+    frame[1] = SND_SNT;
+    frame[2] = I(ns);
+    frame[3] = SND_SNT ^ I(ns);
+    PERF_ENTER(PERF_STUFF);
+    int frameSize = 4 + stuffBytes(payload, size, frame + 4);
+    frameSize += stuffBytes(&bcc2, 1, frame + frameSize);
+    PERF_EXIT();
+    frame[frameSize++] = FLAG;
+    return frameSize;
+}
+
+int decodeInformationFrame(unsigned char *data, int dataSize)
+{
+    int size = destuffBytes(data, dataSize);
+    // XOR of the payload and BCC2
+    if (size <= 0 || blockCheck(data, size) != 0) {
+        return -1;
+    }
+    return size - 1;
+}
@@ -1,74 +1,736 @@
 // Link layer protocol implementation
 
 #include "link_layer.h"
+#include "frame.h"
+#include "perf_counters.h"
 #include "serial_port.h"
+#include "trace.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 
-// Connection establishment macros
-#define FLAG 0x7E
-#define SND_SNT 0x03 // Frames sent by sender
-#define RCV_ANS 0x03 // Answers from the receiver 
-#define SET 0x03
-#define UA 0x07
+// Retransmission timers (milliseconds)
+#define MIN_RETRY_MS 10 // Slack added to the frame + answer transmission time
+
+// Baud rate negotiation macros
+#define MAX_BAUD_RATES 16
+#define PROBE_DATA_SIZE 64
+#define PROBE_FRAMES 10
+#define MAX_PROBE_ERROR_RATE 0.1 // Fall back if more probes than this fail
+
+// Connection parameters and statistics
+static LinkLayer connection;
+
+// Sequence numbers and retransmission timer state
+static int ns = 0;                  // Next information frame to send
+static int nr = 0;                  // Next information frame expected
+static int disconnecting = FALSE;   // DISC already received by llread
+static double srttMs = 0;           // Smoothed round-trip time
+static double rttvarMs = 0;         // Round-trip time variation
+static double rtoMs = 0;            // Retransmission timeout
+static struct timespec lineFree;    // Estimated end of the last frame sent
+
+static struct {
+    double setupMs;       // Time taken by llopen to establish the connection
+    double teardownMs;    // Time taken by llclose to end it
+    double rttMs;         // Last command / answer round-trip time
+    int setSent;          // SET frames sent (first one plus retransmissions)
+    int uaSent;           // UA frames sent
+    int staleBytes;       // Bytes from earlier sessions discarded on open
+    int initialBaudRate;  // Baud rate the connection was opened with
+    int probesSent;       // Test frames sent while negotiating the baud rate
+    int probesFailed;     // Test frames not answered correctly
+    int framesSent;       // Information frames sent (excluding retransmissions)
+    int retransmissions;  // Information frames sent again
+    int timeouts;         // Retransmission timer expirations
+    int rejReceived;      // REJ answers received
+    int framesReceived;   // Information frames accepted
+    int duplicates;       // Information frames received twice
+    int rejSent;          // REJ answers sent
+    long payloadBytes;    // Payload bytes sent or accepted
+    int rttSamples;       // Round-trip times measured (never on retransmissions)
+    double rttSumMs;
+    double rttMinMs;
+    double rttMaxMs;
+    int maxQueued;        // Deepest driver output queue seen after a write
+    double drainMs;       // Time spent waiting for frames to leave the queue
+} stats;
+
+////////////////////////////////////////////////
+// AUXILIARY
+////////////////////////////////////////////////
+
+// Milliseconds elapsed since "start"
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    serialPortTime(&now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Time needed to put "numBytes" on the wire (10 bits per byte, 8-N-1)
+static double frame_time_ms(int numBytes)
+{
+    return numBytes * 10 * 1e3 / connection.baudRate;
+}
+
+// Move "t" forward by "ms" milliseconds
+static void add_ms(struct timespec *t, double ms)
+{
+    long long ns = t->tv_nsec + (long long) (ms * 1e6);
+    t->tv_sec += ns / 1000000000LL;
+    t->tv_nsec = ns % 1000000000LL;
+}
+
+// Write the whole buffer, retrying on partial writes.
+// Returns -1 on error, otherwise the number of bytes written.
+static int write_all(const unsigned char *buf, int size)
+{
+    int written = 0;
+    PERF_ENTER(PERF_WRITE);
+    while (written < size) {
+        int bytes = writeBytes((const char *) buf + written, size - written);
+        if (bytes < 0) {
+            written = -1;
+            break;
+        }
+        written += bytes;
+    }
+    PERF_EXIT();
+    return written;
+}
+
+// Send a frame and wait for it to leave the driver output queue, so that
+// timers started afterwards do not include the time spent queued. The
+// departure time is stored in "sent" (if not NULL): once the queue drained,
+// but not before the frame's wire time has passed since the line was free,
+// as ptys and the cable report an empty queue while frames are still being
+// sent (a retransmission can follow a frame cut short by the receiver).
+// Returns -1 on error.
+static int send_frame(const unsigned char *frame, int size, struct timespec *sent)
+{
+    struct timespec start;
+    serialPortTime(&start);
+    if (elapsed_ms(&lineFree) < 0) {
+        start = lineFree;
+    }
+    if (write_all(frame, size) < 0) {
+        return -1;
+    }
+    TRACE_EVENT(TRACE_FRAME_WRITTEN, frame[2]);
+
+    int queued = outputQueueBytes();
+    if (queued > stats.maxQueued) {
+        stats.maxQueued = queued;
+    }
+
+    struct timespec written;
+    serialPortTime(&written);
+    PERF_ENTER(PERF_WAIT);
+    int res = queued > 0 ? waitOutputQueue(0, connection.timeout * 1000) : 1;
+    PERF_EXIT();
+    if (res < 0) {
+        return -1;
+    }
+    stats.drainMs += elapsed_ms(&written);
+    TRACE_EVENT(TRACE_FRAME_DRAINED, frame[2]);
+
+    double leftMs = frame_time_ms(size) - elapsed_ms(&start);
+    serialPortTime(&lineFree);
+    if (leftMs > 0) add_ms(&lineFree, leftMs);
+    if (sent != NULL) *sent = lineFree;
+    return 0;
+}
+
+static int send_su_frame(unsigned char a, unsigned char c, struct timespec *sent)
+{
+    unsigned char buf[SU_FRAME_SIZE] = {FLAG, a, c, a ^ c, FLAG};
+
+    return send_frame(buf, SU_FRAME_SIZE, sent);
+}
+
+// Update the retransmission timeout with a new round-trip time sample
+// (Jacobson / Karels, as in RFC 6298), bounded by the configured timeout.
+static void update_rto(double rttMs)
+{
+    if (stats.rttSamples == 0 && srttMs == 0) {
+        srttMs = rttMs;
+        rttvarMs = rttMs / 2;
+    }
+    else {
+        double err = srttMs > rttMs ? srttMs - rttMs : rttMs - srttMs;
+        rttvarMs = 0.75 * rttvarMs + 0.25 * err;
+        srttMs = 0.875 * srttMs + 0.125 * rttMs;
+    }
+
+    rtoMs = srttMs + 4 * rttvarMs;
+    if (rtoMs < MIN_RETRY_MS) rtoMs = MIN_RETRY_MS;
+    if (rtoMs > connection.timeout * 1e3) rtoMs = connection.timeout * 1e3;
+}
+
+// Receive a frame, waiting at most timeoutMs milliseconds (negative waits
+// forever). The address and control fields are stored in "a" and "c", and the
+// bytes between BCC1 and the closing flag (at most maxDataSize) in "data".
+// Returns -1 on error, 0 on timeout, 1 if a frame was received, in which case
+// its data size is stored in *dataSize.
+static int receive_frame(unsigned char *a, unsigned char *c, unsigned char *data,
+                         int maxDataSize, int *dataSize, int timeoutMs)
+{
+    struct timespec start;
+    serialPortTime(&start);
+
+    FrameParser parser;
+    initFrameParser(&parser, data, maxDataSize);
+
+    // Waiting and reading are phases of their own within the port functions
+    PERF_ENTER(PERF_PARSE);
+    int res;
+    while (TRUE) {
+        int remaining = -1;
+        if (timeoutMs >= 0) {
+            remaining = timeoutMs - (int) elapsed_ms(&start);
+            if (remaining < 0) {
+                res = 0;
+                break;
+            }
+        }
+
+        res = waitForByte(remaining);
+        if (res <= 0) {
+            break;
+        }
+
+        unsigned char byte;
+        res = readByte((char *) &byte);
+        if (res < 0) {
+            break;
+        }
+        if (res == 1 && parseFrameByte(&parser, byte)) {
+            break;
+        }
+    }
+    PERF_EXIT();
+    if (res != 1) {
+        return res;
+    }
+
+    TRACE_EVENT(TRACE_FRAME_RECEIVED, parser.c);
+    *a = parser.a;
+    *c = parser.c;
+    *dataSize = parser.dataSize;
+    return 1;
+}
+
+// Receive a supervision / unnumbered frame with address "a", waiting at most
+// timeoutMs milliseconds (negative waits forever). The control field is
+// stored in "c".
+// Returns -1 on error, 0 on timeout, 1 if a frame was received.
+static int receive_su_frame(unsigned char a, unsigned char *c, int timeoutMs)
+{
+    struct timespec start;
+    serialPortTime(&start);
+
+    while (TRUE) {
+        int remaining = -1;
+        if (timeoutMs >= 0) {
+            remaining = timeoutMs - (int) elapsed_ms(&start);
+            if (remaining < 0) {
+                return 0;
+            }
+        }
+
+        unsigned char addr;
+        int dataSize;
+        int res = receive_frame(&addr, c, NULL, 0, &dataSize, remaining);
+        if (res != 1 || addr == a) {
+            return res;
+        }
+    }
+}
+
+// Answer expected for a command sent by this side of the connection
+static int is_answer(unsigned char cmd, unsigned char a, unsigned char c)
+{
+    if ((cmd & BAUD_MASK) == BAUD) return a == RCV_ANS && (c & BAUD_MASK) == BAUD;
+    if (cmd == SET) return a == RCV_ANS && c == UA;
+    if (cmd == DISC && connection.role == LlTx) return a == RCV_SNT && c == DISC;
+    return a == SND_ANS && c == UA; // To the receiver's DISC
+}
+
+// Send command "cmd" until its answer arrives, storing it in "answer". A
+// baud rate index "rate" (unless negative) goes in the frame as its data.
+// The retransmission timer starts, once the command left the output queue,
+// at a few frame times and doubles on every retry, up to the configured
+// timeout. The exchange is bounded, from "start", by the time the original
+// "1 + nRetransmissions attempts x timeout" policy allowed.
+// Returns -1 on error or if no answer arrived in time.
+static int send_command(unsigned char cmd, int rate, unsigned char *answer,
+                        const struct timespec *start)
+{
+    unsigned char a = connection.role == LlTx ? SND_SNT : RCV_SNT;
+    // Data is the index and BCC2, equal to it (never a FLAG or ESC)
+    unsigned char frame[SU_FRAME_SIZE + 2] = {FLAG, a, cmd, a ^ cmd, rate, rate, FLAG};
+    double budgetMs = (connection.nRetransmissions + 1) * connection.timeout * 1e3;
+    double maxRetryMs = connection.timeout * 1e3;
+    double retryMs = 2 * frame_time_ms(SU_FRAME_SIZE) + MIN_RETRY_MS;
+    int sent = 0;
+    struct timespec firstSent;
+
+    while (elapsed_ms(start) < budgetMs) {
+        struct timespec sentTime;
+        int res = rate < 0 ? send_su_frame(a, cmd, &sentTime)
+                           : send_frame(frame, sizeof(frame), &sentTime);
+        if (res < 0) {
+            return -1;
+        }
+        if (sent++ == 0) firstSent = sentTime;
+        if (cmd == SET) stats.setSent++;
+
+        // Wait for the answer until the retransmission timer fires
+        double waitMs;
+        while ((waitMs = retryMs - elapsed_ms(&sentTime)) > 0) {
+            unsigned char addr;
+            int dataSize;
+            int res = receive_frame(&addr, answer, NULL, 0, &dataSize, (int) waitMs + 1);
+            if (res < 0) {
+                return -1;
+            }
+            if (res == 1 && is_answer(cmd, addr, *answer)) {
+                // The answer may be to any copy sent: the first one gives
+                // an upper bound (the last one could give far too little)
+                stats.rttMs = elapsed_ms(sent == 1 ? &sentTime : &firstSent);
+                if (stats.rttMs < 0) stats.rttMs = 0;
+                return 0;
+            }
+        }
+
+        retryMs *= 2;
+        if (retryMs > maxRetryMs) {
+            retryMs = maxRetryMs;
+        }
+    }
+
+    fprintf(stderr, "No answer received after %d frames (command 0x%02X)\n", sent, cmd);
+    return -1;
+}
 
 ////////////////////////////////////////////////
 // LLOPEN
 ////////////////////////////////////////////////
 
-static void send_set_cmd(int fd)
+// Index of "baudRate" in the supported baud rate table, or -1.
+static int baud_index(int baudRate)
 {
-    // Create buffer
-    unsigned char buf[15] = {0};
-    
-    // Send SET command
-    buf[0] = FLAG;
-    buf[1] = SND_SNT;
-    buf[2] = SET;
-    buf[3] = SND_SNT ^ SET;
-    buf[4] = FLAG;
+    const int *rates;
+    int n = supportedBaudRates(&rates);
+    for (int i = 0; i < n && i < MAX_BAUD_RATES; i++) {
+        if (rates[i] == baudRate) return i;
+    }
+    return -1;
+}
 
-    int bytes = write(fd, buf, 15);
+// Index of the highest supported baud rate not above "maxBaudRate".
+static int max_baud_index(int maxBaudRate)
+{
+    const int *rates;
+    int n = supportedBaudRates(&rates);
+    int max = -1;
+    for (int i = 0; i < n && i < MAX_BAUD_RATES; i++) {
+        if (rates[i] <= maxBaudRate) max = i;
+    }
+    return max;
+}
+
+static int switch_baud_rate(int index)
+{
+    const int *rates;
+    supportedBaudRates(&rates);
+    if (setBaudRate(rates[index]) < 0) {
+        return -1;
+    }
+    connection.baudRate = rates[index];
+    return 0;
+}
+
+// Test frame contents, known to both sides (never a FLAG, so no stuffing).
+static unsigned char probe_byte(int i)
+{
+    unsigned char byte = i * 7 + 3;
+    return byte == FLAG ? 0x55 : byte;
+}
+
+// Send test frames at the current baud rate.
+// Returns TRUE if the error rate stayed within MAX_PROBE_ERROR_RATE.
+static int probe_baud_rate(void)
+{
+    unsigned char frame[PROBE_DATA_SIZE + SU_FRAME_SIZE] = {FLAG, SND_SNT, PROBE, SND_SNT ^ PROBE};
+    for (int i = 0; i < PROBE_DATA_SIZE; i++) {
+        frame[4 + i] = probe_byte(i);
+    }
+    frame[sizeof(frame) - 1] = FLAG;
+
+    // The last round trip happened at a lower rate, so it is an upper bound
+    int waitMs = (int) (stats.rttMs + 2 * frame_time_ms(sizeof(frame))) + MIN_RETRY_MS;
+    int maxFailed = (int) (PROBE_FRAMES * MAX_PROBE_ERROR_RATE);
+    int failed = 0;
+
+    for (int i = 0; i < PROBE_FRAMES && failed <= maxFailed; i++) {
+        if (send_frame(frame, sizeof(frame), NULL) < 0) {
+            return FALSE;
+        }
+        stats.probesSent++;
+
+        unsigned char c;
+        if (receive_su_frame(RCV_ANS, &c, waitMs) != 1 || c != PROBE) {
+            failed++;
+            stats.probesFailed++;
+        }
+    }
+
+    return failed <= maxFailed;
+}
+
+// Transmitter side of the handshake: send SET until UA arrives. When a
+// higher maximum baud rate is configured, the handshake starts with a BAUD
+// proposal instead, and the rate is raised one step at a time while test
+// frames get through, falling back to the last rate that worked. The SET
+// that follows then carries the chosen rate, which the receiver switches to
+// before answering UA, so that both sides end at the same rate.
+static int open_tx(const struct timespec *start)
+{
+    unsigned char answer;
+    int current = baud_index(connection.baudRate);
+    int target = max_baud_index(connection.maxBaudRate);
+    int negotiated = current >= 0 && current < target;
+    struct timespec exchangeStart = *start;
+
+    while (current >= 0 && current < target) {
+        if (send_command(BAUD | (current + 1), -1, &answer, &exchangeStart) < 0) {
+            return -1;
+        }
+        serialPortTime(&exchangeStart);
+
+        int next = answer & ~BAUD_MASK;
+        if (next <= current) {
+            break; // Receiver does not accept a higher rate
+        }
+        if (switch_baud_rate(next) < 0) {
+            return -1;
+        }
+        if (!probe_baud_rate()) {
+            if (switch_baud_rate(current) < 0) {
+                return -1;
+            }
+            break;
+        }
+        current = next;
+    }
+
+    if (send_command(SET, negotiated ? current : -1, &answer, &exchangeStart) < 0) {
+        return -1;
+    }
+
+    return 1;
+}
+
+// Receiver side of the handshake: answer SET immediately. BAUD proposals are
+// accepted up to the configured maximum rate (any supported rate if none),
+// and test frames echoed. A rate is kept while commands arrive at it; if
+// none arrives within the timeout, the previous rate is restored. A SET
+// carrying a rate index sets the final rate, before UA is sent.
+static int open_rx(void)
+{
+    int current = baud_index(connection.baudRate);
+    int previous = -1;
+    int cap = max_baud_index(connection.maxBaudRate > 0 ? connection.maxBaudRate : INT_MAX);
+
+    while (TRUE) {
+        unsigned char c;
+        unsigned char data[PROBE_DATA_SIZE + 1];
+        int dataSize;
+        int timeoutMs = previous >= 0 ? connection.timeout * 1000 : -1;
+
+        unsigned char a;
+        int res = receive_frame(&a, &c, data, sizeof(data), &dataSize, timeoutMs);
+        if (res < 0) {
+            return -1;
+        }
+        if (res == 0 && previous < 0) {
+            // Only a hang-up ends an unbounded wait
+            fprintf(stderr, "llopen: serial port closed before SET\n");
+            return -1;
+        }
+        if (res == 0) {
+            // Nothing valid at the proposed rate: go back to the last one
+            if (switch_baud_rate(previous) < 0) {
+                return -1;
+            }
+            current = previous;
+            previous = -1;
+            continue;
+        }
+
+        if (c == PROBE) {
+            int valid = dataSize == PROBE_DATA_SIZE;
+            for (int i = 0; valid && i < PROBE_DATA_SIZE; i++) {
+                valid = data[i] == probe_byte(i);
+            }
+            if (valid && send_su_frame(RCV_ANS, PROBE, NULL) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (a != SND_SNT) {
+            continue;
+        }
+
+        if (c == SET && dataSize == 0) {
+            break;
+        }
+        if (c == SET && dataSize == 2 && data[0] == data[1] && data[0] <= cap) {
+            if (data[0] != current && switch_baud_rate(data[0]) < 0) {
+                return -1;
+            }
+            break;
+        }
+        if (dataSize != 0) {
+            continue;
+        }
+        if ((c & BAUD_MASK) == BAUD && current >= 0) {
+            int next = c & ~BAUD_MASK;
+            if (next > cap) next = cap;
+            if (next < current) next = current;
+
+            // Answer at the current rate, switching once it was transmitted
+            if (send_su_frame(RCV_ANS, BAUD | next, NULL) < 0) {
+                return -1;
+            }
+            if (next != current) {
+                if (switch_baud_rate(next) < 0) {
+                    return -1;
+                }
+                previous = current;
+                current = next;
+            }
+            else {
+                previous = -1;
+            }
+        }
+    }
 
-    // Wait until all bytes have been written to the serial port
-    sleep(1);
+    if (send_su_frame(RCV_ANS, UA, NULL) < 0) {
+        return -1;
+    }
+    stats.uaSent++;
 
-    printf("Sent SET command\n");
-} 
+    return 1;
+}
 
 int llopen(LinkLayer connectionParameters)
 {
+    connection = connectionParameters;
+    memset(&stats, 0, sizeof(stats));
+    stats.initialBaudRate = connection.baudRate;
+    PERF_RESET();
+    ns = 0;
+    nr = 0;
+    disconnecting = FALSE;
+    srttMs = 0;
+
     // Open Serial Port
-    int fd = openSerialPort(connectionParameters.serialPort, connectionParameters.baudRate);
+    if (openSerialPort(connection.serialPort, connection.baudRate) < 0) {
+        return -1;
+    }
+
+    // Timed once open, as the port may run on a virtual clock
+    struct timespec start;
+    serialPortTime(&start);
 
-    if (connectionParameters.role == LlTx) {
-        printf("ola");
-        send_set_cmd(fd);
+    // Only the transmitter drains: an old answer could pass for the UA it
+    // waits for, while the receiver may already hold the first SET, sent
+    // before it opened the port (stale bytes there are skipped as noise)
+    if (connection.role == LlTx) {
+        stats.staleBytes = drainSerialPort();
+        if (stats.staleBytes < 0) {
+            closeSerialPort();
+            return -1;
+        }
     }
-    else {
-        printf("adeus");
+
+    int res = connection.role == LlTx ? open_tx(&start) : open_rx();
+    if (res < 0) {
+        closeSerialPort();
+        return -1;
+    }
+
+    // First retransmission timeout: twice the handshake round trip (the timer
+    // starts once a frame is on the wire, so its size does not count)
+    rtoMs = 2 * stats.rttMs + MIN_RETRY_MS;
+    if (rtoMs > connection.timeout * 1e3) rtoMs = connection.timeout * 1e3;
+
+    stats.setupMs = elapsed_ms(&start);
+    printf("Connection established in %.3f ms (%.1f frame times)\n",
+           stats.setupMs, stats.setupMs / frame_time_ms(SU_FRAME_SIZE));
+    if (connection.baudRate != stats.initialBaudRate) {
+        printf("Baud rate negotiated: %d (started at %d)\n",
+               connection.baudRate, stats.initialBaudRate);
     }
 
-    return fd;
+    return 1;
 }
 
 ////////////////////////////////////////////////
 // LLWRITE
 ////////////////////////////////////////////////
+
 int llwrite(const unsigned char *buf, int bufSize)
 {
-    // TODO
+    if (bufSize < 0 || bufSize > MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
 
-    return 0;
+    // Build the information frame
+    unsigned char frame[MAX_FRAME_SIZE];
+    PERF_ENTER(PERF_BUILD);
+    int size = buildInformationFrame(buf, bufSize, ns, frame);
+    PERF_EXIT();
+    TRACE_EVENT(TRACE_FRAME_QUEUED, ns);
+
+    // Stop and wait, within the same time budget as the original
+    // "1 + nRetransmissions attempts x timeout" policy, plus the time each
+    // attempt takes on the wire (which can exceed the timeout at low rates)
+    struct timespec start;
+    serialPortTime(&start);
+    double budgetMs = (connection.nRetransmissions + 1) * (connection.timeout * 1e3 + frame_time_ms(size));
+    int attempts = 0;
+
+    while (elapsed_ms(&start) < budgetMs) {
+        // The timer starts once the frame left the output queue
+        struct timespec sent;
+        if (send_frame(frame, size, &sent) < 0) {
+            return -1;
+        }
+        if (attempts++ == 0) stats.framesSent++;
+        else stats.retransmissions++;
+
+        int rejected = FALSE;
+        double waitMs;
+        while (!rejected && (waitMs = rtoMs - elapsed_ms(&sent)) > 0) {
+            unsigned char a, c;
+            int dataSize;
+            int res = receive_frame(&a, &c, NULL, 0, &dataSize, (int) waitMs + 1);
+            if (res < 0) {
+                return -1;
+            }
+            if (res == 1 && a == RCV_SNT && c == DISC) {
+                fprintf(stderr, "llwrite: receiver disconnected\n");
+                return -1;
+            }
+            if (res == 0 || a != RCV_ANS) {
+                continue;
+            }
+
+            if (c == RR(1 - ns)) {
+                TRACE_EVENT(TRACE_ACK, c);
+                // Karn: retransmitted frames give ambiguous samples
+                if (attempts == 1) {
+                    double rttMs = elapsed_ms(&sent);
+                    if (rttMs < 0) rttMs = 0; // Faster than the baud rate (sockets)
+                    update_rto(rttMs);
+                    if (stats.rttSamples == 0 || rttMs < stats.rttMinMs) stats.rttMinMs = rttMs;
+                    if (rttMs > stats.rttMaxMs) stats.rttMaxMs = rttMs;
+                    stats.rttSumMs += rttMs;
+                    stats.rttSamples++;
+                }
+                stats.payloadBytes += bufSize;
+                ns = 1 - ns;
+                return bufSize;
+            }
+            if (c == REJ(ns)) {
+                TRACE_EVENT(TRACE_REJ, c);
+                stats.rejReceived++;
+                rejected = TRUE;
+            }
+        }
+
+        if (!rejected) {
+            // Back off until a new round-trip time sample is taken
+            stats.timeouts++;
+            TRACE_EVENT(TRACE_TIMEOUT, (int) (rtoMs * 1e3));
+            rtoMs *= 2;
+            if (rtoMs > connection.timeout * 1e3) rtoMs = connection.timeout * 1e3;
+        }
+    }
+
+    fprintf(stderr, "llwrite: frame not acknowledged after %d attempts\n", attempts);
+    return -1;
 }
 
 ////////////////////////////////////////////////
 // LLREAD
 ////////////////////////////////////////////////
+
 int llread(unsigned char *packet)
 {
-    // TODO
+    unsigned char data[MAX_STUFFED_SIZE];
+    int timeoutMs = (connection.nRetransmissions + 1) * (connection.timeout * 1000 + frame_time_ms(MAX_FRAME_SIZE));
+
+    while (!disconnecting) {
+        unsigned char a, c;
+        int dataSize;
+        int res = receive_frame(&a, &c, data, sizeof(data), &dataSize, timeoutMs);
+        if (res <= 0) {
+            if (res == 0) fprintf(stderr, "llread: no frame received in %d ms\n", timeoutMs);
+            return -1;
+        }
+        if (a != SND_SNT) {
+            continue;
+        }
+
+        // Retransmitted commands whose answer was lost
+        if (c == SET && (dataSize == 0 || dataSize == 2)) {
+            if (send_su_frame(RCV_ANS, UA, NULL) < 0) return -1;
+            stats.uaSent++;
+            continue;
+        }
+        if (c == DISC && dataSize == 0) {
+            disconnecting = TRUE;
+            break;
+        }
+        if ((c != I(0) && c != I(1)) || dataSize == 0) {
+            continue;
+        }
+
+        int frameNs = c == I(1);
+        PERF_ENTER(PERF_DESTUFF);
+        int size = decodeInformationFrame(data, dataSize);
+        PERF_EXIT();
+
+        if (frameNs != nr) {
+            // Duplicate: our RR was lost, acknowledge again
+            stats.duplicates++;
+            if (send_su_frame(RCV_ANS, RR(nr), NULL) < 0) return -1;
+            continue;
+        }
+        if (size < 0) {
+            stats.rejSent++;
+            TRACE_EVENT(TRACE_REJ, REJ(nr));
+            if (send_su_frame(RCV_ANS, REJ(nr), NULL) < 0) return -1;
+            continue;
+        }
+
+        memcpy(packet, data, size);
+        nr = 1 - nr;
+        stats.framesReceived++;
+        stats.payloadBytes += size;
+        if (send_su_frame(RCV_ANS, RR(nr), NULL) < 0) return -1;
+        return size;
+    }
 
     return 0;
 }
@@ -76,10 +738,87 @@ int llread(unsigned char *packet)
 ////////////////////////////////////////////////
 // LLCLOSE
 ////////////////////////////////////////////////
+
 int llclose(int showStatistics)
 {
-    // TODO
+    int res = 0;
+    unsigned char answer;
+    struct timespec start;
+    struct timespec closeStart;
+    serialPortTime(&closeStart);
+
+    if (connection.role == LlTx) {
+        serialPortTime(&start);
+        res = send_command(DISC, -1, &answer, &start);
+        if (res == 0) {
+            res = send_su_frame(SND_ANS, UA, NULL);
+        }
+    }
+    else {
+        // Without waiting for the transmitter's DISC if the application
+        // stopped reading before it: the transmitter gives up on the frame
+        // it is sending as soon as this DISC arrives
+        if (!disconnecting) fprintf(stderr, "llclose: disconnecting before the transmitter\n");
+        serialPortTime(&start);
+        res = send_command(DISC, -1, &answer, &start);
+    }
+    stats.teardownMs = elapsed_ms(&closeStart);
+
+    if (showStatistics) {
+        printf("Link layer statistics\n"
+               "  - Connection setup: %.3f ms\n"
+               "  - Disconnection: %.3f ms\n"
+               "  - SET frames sent: %d\n"
+               "  - UA frames sent: %d\n"
+               "  - Stale bytes discarded: %d\n"
+               "  - Baud rate: %d (initial %d)\n"
+               "  - Baud rate test frames: %d sent, %d failed\n",
+               stats.setupMs,
+               stats.teardownMs,
+               stats.setSent,
+               stats.uaSent,
+               stats.staleBytes,
+               connection.baudRate,
+               stats.initialBaudRate,
+               stats.probesSent,
+               stats.probesFailed);
+        if (connection.role == LlTx) {
+            printf("  - Information frames sent: %d (%d retransmissions)\n"
+                   "  - Timeouts: %d\n"
+                   "  - REJ received: %d\n"
+                   "  - Payload bytes sent: %ld\n"
+                   "  - Round-trip time: %.3f / %.3f / %.3f ms (min / avg / max, %d samples)\n"
+                   "  - Retransmission timeout: %.3f ms\n"
+                   "  - Output queue: %d bytes max, %.3f ms waiting to drain\n",
+                   stats.framesSent,
+                   stats.retransmissions,
+                   stats.timeouts,
+                   stats.rejReceived,
+                   stats.payloadBytes,
+                   stats.rttMinMs,
+                   stats.rttSamples > 0 ? stats.rttSumMs / stats.rttSamples : 0,
+                   stats.rttMaxMs,
+                   stats.rttSamples,
+                   rtoMs,
+                   stats.maxQueued,
+                   stats.drainMs);
+        }
+        else {
+            printf("  - Information frames received: %d (%d duplicates)\n"
+                   "  - REJ sent: %d\n"
+                   "  - Payload bytes received: %ld\n",
+                   stats.framesReceived,
+                   stats.duplicates,
+                   stats.rejSent,
+                   stats.payloadBytes);
+        }
+        PERF_PRINT();
+    }
+
+#ifdef TRACE
+    if (traceDump(connection.role == LlTx ? "tx" : "rx") < 0) res = -1;
+#endif
 
     int clstat = closeSerialPort();
-    return clstat;
-}
\ No newline at end of file
+    return res < 0 ? -1 : clstat;
+}
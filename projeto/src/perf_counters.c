@@ -0,0 +1,184 @@
+// Performance counters per phase (see perf_counters.h)
+
+#include "perf_counters.h"
+
+#ifdef PERF_COUNTERS
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_DEPTH 16
+
+enum
+{
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,
+    TASK_CLOCK,
+    CONTEXT_SWITCHES,
+    N_COUNTERS
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} counterEvent[N_COUNTERS] = {
+    [CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [CACHE_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    [CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+static const char *phaseName[PERF_PHASES] = {
+    [PERF_OTHER] = "other",
+    [PERF_BUILD] = "build",
+    [PERF_STUFF] = "stuff",
+    [PERF_WRITE] = "write",
+    [PERF_WAIT] = "wait",
+    [PERF_READ] = "read",
+    [PERF_PARSE] = "parse",
+    [PERF_DESTUFF] = "destuff",
+    [PERF_FILE_READ] = "file read",
+    [PERF_FILE_WRITE] = "file write",
+};
+
+static int opened = 0;
+static int leaderFd = -1;
+static int slot[N_COUNTERS];      // Position in the group read, or -1
+static int nSlots = 0;
+static int userOnly = 0;          // Kernel time could not be counted
+
+static uint64_t last[N_COUNTERS]; // Values at the last phase switch
+static uint64_t lastWallNs;
+static uint64_t total[PERF_PHASES][N_COUNTERS];
+static uint64_t wallNs[PERF_PHASES];
+static long calls[PERF_PHASES];
+
+static PerfPhase stack[MAX_DEPTH];
+static int depth = 0;              // Phases entered; "other" below them
+
+static int open_counter(int counter, int excludeKernel)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counterEvent[counter].type;
+    attr.config = counterEvent[counter].config;
+    attr.exclude_kernel = excludeKernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, leaderFd, 0);
+}
+
+// Open every counter available, in a single group read at once.
+static void open_counters(void)
+{
+    opened = 1;
+    for (int i = 0; i < N_COUNTERS; i++) {
+        int fd = open_counter(i, userOnly);
+        if (fd < 0 && !userOnly) {
+            // Counting the kernel needs a lower perf_event_paranoid
+            fd = open_counter(i, 1);
+            if (fd >= 0) userOnly = 1;
+        }
+        slot[i] = fd < 0 ? -1 : nSlots++;
+        if (fd >= 0 && leaderFd < 0) leaderFd = fd;
+    }
+}
+
+// Read the counters, charging what they counted since the last switch to
+// the current phase.
+static void switch_phase(void)
+{
+    struct {
+        uint64_t nr;
+        uint64_t values[N_COUNTERS];
+    } group;
+
+    if (leaderFd < 0 || read(leaderFd, &group, sizeof(group)) <= 0) {
+        return;
+    }
+
+    PerfPhase phase = depth > 0 ? stack[depth - 1] : PERF_OTHER;
+    for (int i = 0; i < N_COUNTERS; i++) {
+        if (slot[i] < 0) continue;
+        uint64_t value = group.values[slot[i]];
+        total[phase][i] += value - last[i];
+        last[i] = value;
+    }
+
+    // Real time, even on the virtual clock of the cable
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nowNs = now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (lastWallNs != 0) wallNs[phase] += nowNs - lastWallNs;
+    lastWallNs = nowNs;
+}
+
+void perfEnter(PerfPhase phase)
+{
+    if (!opened) open_counters();
+    switch_phase();
+    if (depth < MAX_DEPTH) stack[depth] = phase;
+    depth++;
+    calls[phase]++;
+}
+
+void perfExit(void)
+{
+    switch_phase();
+    if (depth > 0) depth--;
+}
+
+void perfReset(void)
+{
+    switch_phase();
+    memset(total, 0, sizeof(total));
+    memset(wallNs, 0, sizeof(wallNs));
+    memset(calls, 0, sizeof(calls));
+}
+
+static void print_count(int phase, int counter)
+{
+    if (slot[counter] < 0) printf(" %12s", "n/a");
+    else printf(" %12llu", (unsigned long long) total[phase][counter]);
+}
+
+void perfPrint(void)
+{
+    if (!opened) open_counters();
+    switch_phase();
+    if (leaderFd < 0) {
+        printf("Performance counters: not available\n");
+        return;
+    }
+
+    printf("Performance counters per phase%s\n"
+           "  %-10s %8s %10s %10s %12s %12s %12s %12s %5s\n",
+           userOnly ? " (user space only)" : "",
+           "phase", "calls", "wall ms", "cpu ms", "cycles", "instructions",
+           "cache miss", "ctx switch", "IPC");
+    for (int p = 0; p < PERF_PHASES; p++) {
+        if (calls[p] == 0 && p != PERF_OTHER) continue;
+        if (p == PERF_OTHER) printf("  %-10s %8s", phaseName[p], "-");
+        else printf("  %-10s %8ld", phaseName[p], calls[p]);
+        printf(" %10.3f", wallNs[p] / 1e6);
+        if (slot[TASK_CLOCK] < 0) printf(" %10s", "n/a");
+        else printf(" %10.3f", total[p][TASK_CLOCK] / 1e6);
+        print_count(p, CYCLES);
+        print_count(p, INSTRUCTIONS);
+        print_count(p, CACHE_MISSES);
+        print_count(p, CONTEXT_SWITCHES);
+        if (slot[CYCLES] < 0 || slot[INSTRUCTIONS] < 0 || total[p][CYCLES] == 0) printf(" %5s\n", "n/a");
+        else printf(" %5.2f\n", (double) total[p][INSTRUCTIONS] / total[p][CYCLES]);
+    }
+}
+
+#endif // PERF_COUNTERS
@@ -2,125 +2,327 @@
 // DO NOT CHANGE THIS FILE
 
 #include "serial_port.h"
+#include "perf_counters.h"
+#include "transport.h"
+#include "virtual_clock.h"
 
-#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <termios.h>
-#include <unistd.h>
+#include <time.h>
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
 
-int fd = -1; // File descriptor for open serial port
-struct termios oldtio; // Serial port settings to restore on closing
+static Transport port = { .ops = NULL, .fd = -1 }; // Open serial port
+
+// Received bytes not yet returned by readByte
+#define RX_BUF_SIZE 4096
+static char rxBuf[RX_BUF_SIZE];
+static int rxPos = 0;
+static int rxLen = 0;
+
+// Bytes moved through the port, to tell the virtual clock (if attached)
+// whether bytes are still on their way
+static int64_t bytesWritten = 0;
+static int64_t bytesRead = 0;
+
+// Transmit pacing: writeBytes keeps at most TX_QUEUE_TARGET bytes queued in
+// the driver, refilling once the queue drops to TX_QUEUE_LOW
+#define TX_QUEUE_TARGET 32
+#define TX_QUEUE_LOW (TX_QUEUE_TARGET / 2)
+
+// Standard baud rates accepted by openSerialPort, in increasing order
+static const int baudRates[] = {1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200,
+                                230400, 460800, 921600};
 
 // Open and configure the serial port.
+// The address selects the transport backend (see transport.h).
 // Returns -1 on error.
 int openSerialPort(const char *serialPort, int baudRate)
 {
-    // Open with O_NONBLOCK to avoid hanging when CLOCAL
-    // is not yet set on the serial port (changed later)
-    int oflags = O_RDWR | O_NOCTTY | O_NONBLOCK;
-    fd = open(serialPort, oflags);
-    if (fd < 0)
+    const char *address;
+    const TransportOps *ops = findTransport(serialPort, &address);
+    if (ops == NULL)
     {
-        perror(serialPort);
+        fprintf(stderr, "Unknown transport for %s\n", serialPort);
         return -1;
     }
 
-    // Save current port settings
-    if (tcgetattr(fd, &oldtio) == -1)
+    memset(&port, 0, sizeof(port));
+    port.fd = -1;
+    if (ops->open(&port, address, baudRate) == -1)
     {
-        perror("tcgetattr");
         return -1;
     }
+    port.ops = ops;
+    port.baudRate = baudRate;
+    rxPos = 0;
+    rxLen = 0;
+    bytesWritten = 0;
+    bytesRead = 0;
 
-    // Convert baud rate to appropriate flag
-    tcflag_t br;
-    switch (baudRate)
-    {
-        case 1200: br = B1200; break;
-        case 1800: br = B1800; break;
-        case 2400: br = B2400; break;
-        case 4800: br = B4800; break;
-        case 9600: br = B9600; break;
-        case 19200: br = B19200; break;
-        case 38400: br = B38400; break;
-        case 57600: br = B57600; break;
-        case 115200: br = B115200; break;
-        default:
-            fprintf(stderr, "Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200)\n");
+    // Run on the cable's virtual clock, if asked to
+    const char *clockSocket = getenv(CLOCK_ENV);
+    if (clockSocket != NULL && ops == &ttyTransport)
+    {
+        char path[PATH_MAX];
+        if (realpath(address, path) == NULL || clockAttach(clockSocket, path) != 0)
+        {
+            closeSerialPort();
             return -1;
+        }
     }
 
-    // New port settings
-    struct termios newtio;
-    memset(&newtio, 0, sizeof(newtio));
+    // Done
+    return 0;
+}
 
-    newtio.c_cflag = br | CS8 | CLOCAL | CREAD;
-    newtio.c_iflag = IGNPAR;
-    newtio.c_oflag = 0;
 
-    // Set input mode (non-canonical, no echo,...)
-    newtio.c_lflag = 0;
-    newtio.c_cc[VTIME] = 0; // Block reading
-    newtio.c_cc[VMIN] = 1;  // Byte by byte
+// Restore original port settings and close the serial port.
+// Returns -1 on error.
+int closeSerialPort(void)
+{
+    int res = port.ops->close(&port);
+    port.ops = NULL;
+    clockDetach();
+    return res;
+}
 
-    tcflush(fd, TCIOFLUSH);
 
-    // Set new port settings
-    if (tcsetattr(fd, TCSANOW, &newtio) == -1)
+// Wait for a byte received from the serial port and read it (must
+// check whether a byte was actually received from the return value).
+// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
+int readByte(char *byte)
+{
+    if (rxPos == rxLen)
     {
-        perror("tcsetattr");
-        close(fd);
-        return -1;
+        // Take everything already received in one call
+        PERF_ENTER(PERF_READ);
+        int n = port.ops->read(&port, rxBuf, RX_BUF_SIZE);
+        PERF_EXIT();
+        if (n <= 0)
+        {
+            if (n == 0) fprintf(stderr, "Serial port closed by the other side\n");
+            return -1;
+        }
+        rxPos = 0;
+        rxLen = n;
+        bytesRead += n;
+    }
+
+    *byte = rxBuf[rxPos++];
+    return 1;
+}
+
+
+// Write up to numBytes to the serial port (must check how many were actually
+// written in the return value).
+// Blocks until the driver output queue is short enough, so that it never
+// holds more than TX_QUEUE_TARGET bytes.
+// Returns -1 on error, otherwise the number of bytes written.
+int writeBytes(const char *bytes, int numBytes)
+{
+    if (port.ops->outputQueue == NULL)
+    {
+        int n = port.ops->write(&port, bytes, numBytes);
+        bytesWritten += n > 0 ? n : 0;
+        return n;
     }
 
-    // Clear O_NONBLOCK flag to ensure blocking reads
-    oflags ^= O_NONBLOCK;
-    if (fcntl(fd, F_SETFL, oflags) == -1)
+    int queued = outputQueueBytes();
+    if (queued > TX_QUEUE_LOW)
+    {
+        if (waitOutputQueue(TX_QUEUE_LOW, -1) == -1)
+        {
+            return -1;
+        }
+        queued = outputQueueBytes();
+    }
+    if (queued < 0)
     {
-        perror("fcntl");
-        close(fd);
         return -1;
     }
 
-    // Done
-    return fd;
+    int room = TX_QUEUE_TARGET - queued;
+    if (numBytes > room)
+    {
+        numBytes = room;
+    }
+
+    int n = port.ops->write(&port, bytes, numBytes);
+    bytesWritten += n > 0 ? n : 0;
+    return n;
 }
 
 
-// Restore original port settings and close the serial port.
+// Get the number of bytes waiting in the driver output queue.
 // Returns -1 on error.
-int closeSerialPort(void)
+int outputQueueBytes(void)
+{
+    if (port.ops->outputQueue == NULL)
+    {
+        return 0;
+    }
+    return port.ops->outputQueue(&port);
+}
+
+
+// Wait up to timeoutMs milliseconds (negative waits forever) for the driver
+// output queue to drop to maxQueued bytes or less.
+// Returns -1 on error, 0 on timeout, 1 once the queue is short enough.
+int waitOutputQueue(int maxQueued, int timeoutMs)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1)
+    {
+        int queued = outputQueueBytes();
+        if (queued < 0)
+        {
+            return -1;
+        }
+        if (queued <= maxQueued)
+        {
+            return 1;
+        }
+
+        // Sleep for as long as the excess bytes take to be transmitted
+        // (10 bits per byte), without going past the deadline
+        long waitNs = (long) ((queued - maxQueued) * 1e10 / port.baudRate);
+        if (timeoutMs >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long remainingNs = timeoutMs * 1000000L - ((now.tv_sec - start.tv_sec) * 1000000000L
+                                                       + (now.tv_nsec - start.tv_nsec));
+            if (remainingNs <= 0)
+            {
+                return 0;
+            }
+            if (waitNs > remainingNs)
+            {
+                waitNs = remainingNs;
+            }
+        }
+
+        struct timespec wait = { .tv_sec = waitNs / 1000000000L, .tv_nsec = waitNs % 1000000000L };
+        nanosleep(&wait, NULL);
+    }
+}
+
+
+// Wait for bytes to arrive at the port (see waitForByte).
+static int wait_port(int timeoutMs)
 {
-    // Restore the old port settings
-    if (tcsetattr(fd, TCSANOW, &oldtio) == -1)
+    if (!clockAttached())
+    {
+        return port.ops->wait(&port, timeoutMs);
+    }
+
+    // Virtual time: let the cable run the clock until bytes are delivered
+    // or the timeout expires
+    int ready = port.ops->wait(&port, 0);
+    if (ready != 0)
+    {
+        return ready;
+    }
+    int64_t delivered;
+    if (clockWait(timeoutMs, bytesWritten, bytesRead, &delivered) != 0)
     {
-        perror("tcsetattr");
         return -1;
     }
+    if (delivered > bytesRead)
+    {
+        // Delivered, but still on the way through the pseudo-terminal
+        return port.ops->wait(&port, -1);
+    }
+    return 0;
+}
 
-    return close(fd);
+// Wait up to timeoutMs milliseconds for a byte to be available for reading
+// (a negative timeoutMs waits forever).
+// Returns -1 on error, 0 on timeout, 1 if a byte can be read.
+int waitForByte(int timeoutMs)
+{
+    if (rxPos < rxLen)
+    {
+        return 1;
+    }
+
+    PERF_ENTER(PERF_WAIT);
+    int ready = wait_port(timeoutMs);
+    PERF_EXIT();
+    return ready;
 }
 
 
-// Wait for a byte received from the serial port and read it (must
-// check whether a byte was actually received from the return value).
-// Returns -1 on error, 0 if no byte was received, 1 if a byte was received.
-int readByte(char *byte)
+// Discard stale bytes left in the serial port by a previous session.
+// Returns -1 on error, otherwise the number of input bytes discarded.
+int drainSerialPort(void)
+{
+    int discarded = rxLen - rxPos;
+    rxPos = rxLen;
+
+    int available;
+    while ((available = port.ops->readable(&port)) > 0)
+    {
+        int n = port.ops->read(&port, rxBuf, available < RX_BUF_SIZE ? available : RX_BUF_SIZE);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        discarded += n;
+        bytesRead += n;
+    }
+
+    return available < 0 ? -1 : discarded;
+}
+
+
+// Get the baud rates supported by openSerialPort, in increasing order.
+// Returns the number of entries stored in *rates.
+int supportedBaudRates(const int **rates)
 {
-    return read(fd, byte, 1);
+    *rates = baudRates;
+    return sizeof(baudRates) / sizeof(baudRates[0]);
 }
 
 
-// Write up to numBytes to the serial port (must check how many were actually
-// written in the return value).
-// Returns -1 on error, otherwise the number of bytes written.
-int writeBytes(const char *bytes, int numBytes)
+// Change the baud rate of the open serial port, once all pending output has
+// been transmitted at the current rate.
+// Returns -1 on error.
+int setBaudRate(int baudRate)
 {
-    return write(fd, bytes, numBytes);
+    if (port.ops->setBaudRate != NULL && port.ops->setBaudRate(&port, baudRate) == -1)
+    {
+        return -1;
+    }
+    port.baudRate = baudRate;
+    return 0;
+}
+
+
+// Check whether the open serial port accepts arbitrary baud rates
+// (termios2 / BOTHER).
+// Returns 1 if it does, 0 otherwise.
+int customBaudRateSupported(void)
+{
+    return port.ops->customBaudRate == NULL || port.ops->customBaudRate(&port);
+}
+
+
+// Get the current time of the serial port clock: CLOCK_MONOTONIC, or the
+// cable's virtual clock if attached to it.
+void serialPortTime(struct timespec *t)
+{
+    if (clockAttached())
+    {
+        clockTime(t);
+    }
+    else
+    {
+        clock_gettime(CLOCK_MONOTONIC, t);
+    }
 }
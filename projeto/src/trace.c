@@ -0,0 +1,111 @@
+// Per-frame event tracing (see trace.h)
+
+#include "trace.h"
+
+#ifdef TRACE
+
+#include "link_layer.h"
+#include "serial_port.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    int64_t timeNs;
+    int type;
+    int value;
+} TraceRecord;
+
+static const struct {
+    const char *name;
+    const char *category;
+    const char *valueName;
+} eventInfo[TRACE_EVENT_TYPES] = {
+    [TRACE_FRAME_QUEUED] = {"frame queued", "link", "ns"},
+    [TRACE_FRAME_WRITTEN] = {"frame written", "link", "c"},
+    [TRACE_FRAME_DRAINED] = {"frame drained", "link", "c"},
+    [TRACE_FRAME_RECEIVED] = {"frame received", "link", "c"},
+    [TRACE_ACK] = {"ACK", "link", "c"},
+    [TRACE_TIMEOUT] = {"timeout", "link", "rto_us"},
+    [TRACE_REJ] = {"REJ", "link", "c"},
+    [TRACE_DISK_WRITE] = {"disk write", "app", "bytes"},
+};
+
+// Ring buffer of the calling thread, allocated on its first event
+static __thread TraceRecord *ring = NULL;
+static __thread unsigned long recorded = 0;
+
+void traceEvent(TraceEventType type, int value)
+{
+    if (ring == NULL) {
+        ring = malloc(TRACE_CAPACITY * sizeof(TraceRecord));
+        if (ring == NULL) return;
+    }
+
+    struct timespec now;
+    serialPortTime(&now);
+    TraceRecord *r = &ring[recorded++ % TRACE_CAPACITY];
+    r->timeNs = now.tv_sec * 1000000000LL + now.tv_nsec;
+    r->type = type;
+    r->value = value;
+}
+
+int traceDump(const char *processName)
+{
+    const char *path = getenv(TRACE_ENV);
+    if (path == NULL || ring == NULL) {
+        return 0;
+    }
+
+    // The file starts the JSON array; its closing bracket is optional
+    int created = TRUE;
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        created = FALSE;
+        fd = open(path, O_WRONLY | O_APPEND);
+    }
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    // Formatted in memory and appended at once, so that processes sharing
+    // the file do not interleave their events
+    char *buf;
+    size_t size;
+    FILE *out = open_memstream(&buf, &size);
+    if (out == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    int pid = getpid();
+    int tid = syscall(SYS_gettid);
+    if (created) fprintf(out, "[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}},\n", pid, tid, processName);
+
+    unsigned long first = recorded > TRACE_CAPACITY ? recorded - TRACE_CAPACITY : 0;
+    for (unsigned long i = first; i < recorded; i++) {
+        const TraceRecord *r = &ring[i % TRACE_CAPACITY];
+        fprintf(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                "\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"%s\":%d}},\n",
+                eventInfo[r->type].name, eventInfo[r->type].category, r->timeNs / 1e3,
+                pid, tid, eventInfo[r->type].valueName, r->value);
+    }
+    fclose(out);
+
+    int res = write(fd, buf, size) == (ssize_t) size ? 0 : -1;
+    if (res < 0) perror(path);
+    free(buf);
+    close(fd);
+    recorded = 0;
+    return res;
+}
+
+#endif // TRACE
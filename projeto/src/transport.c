@@ -0,0 +1,85 @@
+// Transport backend selection and in-process endpoint pairs
+
+#include "transport.h"
+
+#include <pty.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+static const TransportOps *transports[] = {
+    &ptyTransport,
+    &socketTransport,
+    &shmTransport,
+    &ttyTransport, // Empty prefix: must be the last one
+};
+
+const TransportOps *findTransport(const char *address, const char **rest)
+{
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+    {
+        size_t len = strlen(transports[i]->prefix);
+        if (strncmp(address, transports[i]->prefix, len) == 0)
+        {
+            *rest = address + len;
+            return transports[i];
+        }
+    }
+    return NULL;
+}
+
+int createTransportPair(const char *backend, char *addressA, char *addressB)
+{
+    int fds[2];
+
+    if (strcmp(backend, "pty") == 0)
+    {
+        // The slave is one side, the master the other
+        if (openpty(&fds[0], &fds[1], NULL, NULL, NULL) == -1)
+        {
+            perror("openpty");
+            return -1;
+        }
+    }
+    else if (strcmp(backend, "socket") == 0)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        {
+            perror("socketpair");
+            return -1;
+        }
+    }
+    else if (strcmp(backend, "shm") == 0)
+    {
+        char name[MAX_ADDRESS_SIZE - 8];
+        if (createShmChannel(name, sizeof(name)) == -1)
+        {
+            return -1;
+        }
+        snprintf(addressA, MAX_ADDRESS_SIZE, "shm:%s:0", name);
+        snprintf(addressB, MAX_ADDRESS_SIZE, "shm:%s:1", name);
+        return 0;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown transport %s (must be pty, socket or shm)\n", backend);
+        return -1;
+    }
+
+    snprintf(addressA, MAX_ADDRESS_SIZE, "%s:%d", backend, fds[0]);
+    snprintf(addressB, MAX_ADDRESS_SIZE, "%s:%d", backend, fds[1]);
+    return 0;
+}
+
+void releaseTransportAddress(const char *address)
+{
+    const char *rest;
+    const TransportOps *ops = findTransport(address, &rest);
+    if (ops == &ptyTransport || ops == &socketTransport)
+    {
+        close(atoi(rest));
+    }
+}
@@ -0,0 +1,278 @@
+// Shared-memory transport backend: a pair of single-producer single-consumer
+// rings in a POSIX shared memory object, one per direction. Waiting uses
+// futexes on a sequence number bumped whenever a ring index moves. Closing a
+// side closes both rings, so that the other side reads end of file (once the
+// bytes left are read) and fails to write.
+
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RING_SIZE 65536 // Power of two, so indices can wrap freely
+
+typedef struct
+{
+    atomic_uint head;     // Bytes ever written (producer)
+    atomic_uint tail;     // Bytes ever read (consumer)
+    atomic_uint seq;      // Futex word, bumped whenever head or tail moves
+    atomic_uint waiters;  // Processes sleeping on seq
+    atomic_uint closed;   // One of the sides was closed
+    char data[SHM_RING_SIZE];
+} ShmRing;
+
+// rings[i] carries the bytes written by side i
+typedef struct
+{
+    ShmRing rings[2];
+} ShmChannel;
+
+typedef struct
+{
+    ShmChannel *channel;
+    int side;
+    char name[MAX_ADDRESS_SIZE];
+} ShmState;
+
+static ShmRing *txRing(Transport *t)
+{
+    ShmState *s = t->state;
+    return &s->channel->rings[s->side];
+}
+
+static ShmRing *rxRing(Transport *t)
+{
+    ShmState *s = t->state;
+    return &s->channel->rings[1 - s->side];
+}
+
+static unsigned used(ShmRing *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire)
+           - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+static void notify(ShmRing *r)
+{
+    atomic_fetch_add_explicit(&r->seq, 1, memory_order_release);
+    if (atomic_load(&r->waiters) > 0)
+    {
+        syscall(SYS_futex, &r->seq, FUTEX_WAKE, __INT_MAX__, NULL, NULL, 0);
+    }
+}
+
+// Wait up to timeoutMs milliseconds (negative waits forever) until the ring
+// has data ("forData") or free space, or is closed.
+// Returns 0 on timeout, 1 once the condition holds.
+static int waitRing(ShmRing *r, int forData, int timeoutMs)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (1)
+    {
+        unsigned seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        unsigned n = used(r);
+        if ((forData ? n > 0 : n < SHM_RING_SIZE) || atomic_load(&r->closed))
+        {
+            return 1;
+        }
+
+        struct timespec timeout, *ptimeout = NULL;
+        if (timeoutMs >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long remainingNs = timeoutMs * 1000000L - ((now.tv_sec - start.tv_sec) * 1000000000L
+                                                       + (now.tv_nsec - start.tv_nsec));
+            if (remainingNs <= 0)
+            {
+                return 0;
+            }
+            timeout.tv_sec = remainingNs / 1000000000L;
+            timeout.tv_nsec = remainingNs % 1000000000L;
+            ptimeout = &timeout;
+        }
+
+        atomic_fetch_add(&r->waiters, 1);
+        syscall(SYS_futex, &r->seq, FUTEX_WAIT, seq, ptimeout, NULL, 0);
+        atomic_fetch_sub(&r->waiters, 1);
+    }
+}
+
+// Map the shared memory object "name", sizing it if "oflags" create it.
+static ShmChannel *mapChannel(const char *name, int oflags)
+{
+    int fd = shm_open(name, oflags, 0600);
+    if (fd < 0)
+    {
+        perror(name);
+        return NULL;
+    }
+    struct stat st;
+    if (oflags & O_CREAT ? ftruncate(fd, sizeof(ShmChannel)) == -1
+                         : fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(ShmChannel))
+    {
+        fprintf(stderr, "%s: not a shared memory channel\n", name);
+        close(fd);
+        return NULL;
+    }
+
+    ShmChannel *channel = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (channel == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    return channel;
+}
+
+// Address: <name>:<side>
+static int shmOpen(Transport *t, const char *address, int baudRate)
+{
+    (void) baudRate;
+
+    const char *sep = strrchr(address, ':');
+    if (sep == NULL || (sep[1] != '0' && sep[1] != '1') || sep[2] != '\0')
+    {
+        fprintf(stderr, "Bad shared memory address %s (must be <name>:<0|1>)\n", address);
+        return -1;
+    }
+
+    ShmState *s = malloc(sizeof(ShmState));
+    if (s == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+    snprintf(s->name, sizeof(s->name), "%s%.*s", address[0] == '/' ? "" : "/",
+             (int) (sep - address), address);
+    s->side = sep[1] - '0';
+
+    // Created by createShmChannel: a missing one means the other side is gone
+    s->channel = mapChannel(s->name, O_RDWR);
+    if (s->channel == NULL)
+    {
+        free(s);
+        return -1;
+    }
+
+    t->state = s;
+    t->fd = -1;
+    return 0;
+}
+
+static int shmClose(Transport *t)
+{
+    ShmState *s = t->state;
+
+    // The first side to close removes the name; mappings stay valid
+    if (shm_unlink(s->name) == -1 && errno != ENOENT)
+    {
+        perror("shm_unlink");
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        atomic_store(&s->channel->rings[i].closed, 1);
+        notify(&s->channel->rings[i]);
+    }
+    int res = munmap(s->channel, sizeof(ShmChannel));
+    free(s);
+    return res;
+}
+
+static int shmReadable(Transport *t)
+{
+    return used(rxRing(t));
+}
+
+static int shmRead(Transport *t, char *bytes, int numBytes)
+{
+    ShmRing *r = rxRing(t);
+    waitRing(r, 1, -1);
+
+    // Nothing left once closed: end of file
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned n = used(r);
+    if (n > (unsigned) numBytes)
+    {
+        n = numBytes;
+    }
+
+    unsigned start = tail % SHM_RING_SIZE;
+    unsigned first = n < SHM_RING_SIZE - start ? n : SHM_RING_SIZE - start;
+    memcpy(bytes, r->data + start, first);
+    memcpy(bytes + first, r->data, n - first);
+
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    notify(r);
+    return n;
+}
+
+static int shmWrite(Transport *t, const char *bytes, int numBytes)
+{
+    ShmRing *r = txRing(t);
+    waitRing(r, 0, -1);
+    if (atomic_load(&r->closed))
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned n = SHM_RING_SIZE - used(r);
+    if (n > (unsigned) numBytes)
+    {
+        n = numBytes;
+    }
+
+    unsigned start = head % SHM_RING_SIZE;
+    unsigned first = n < SHM_RING_SIZE - start ? n : SHM_RING_SIZE - start;
+    memcpy(r->data + start, bytes, first);
+    memcpy(r->data, bytes + first, n - first);
+
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    notify(r);
+    return n;
+}
+
+static int shmWait(Transport *t, int timeoutMs)
+{
+    return waitRing(rxRing(t), 1, timeoutMs);
+}
+
+const TransportOps shmTransport = {
+    .prefix = "shm:",
+    .open = shmOpen,
+    .close = shmClose,
+    .readable = shmReadable,
+    .read = shmRead,
+    .write = shmWrite,
+    .wait = shmWait,
+};
+
+// Create a fresh shared memory object for createTransportPair.
+// Returns -1 on error.
+int createShmChannel(char *name, int size)
+{
+    static int count = 0;
+    snprintf(name, size, "/rc-link-%d-%d", getpid(), count++);
+
+    ShmChannel *channel = mapChannel(name, O_RDWR | O_CREAT | O_EXCL);
+    if (channel == NULL)
+    {
+        return -1;
+    }
+    munmap(channel, sizeof(ShmChannel));
+    return 0;
+}
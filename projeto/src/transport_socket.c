@@ -0,0 +1,81 @@
+// Socket transport backend: inherited socketpair descriptors. There is no
+// line discipline, baud rate or output queue, so only the protocol costs.
+
+#include "transport.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int socketOpen(Transport *t, const char *address, int baudRate)
+{
+    (void) baudRate;
+
+    // Use a private copy of the inherited descriptor
+    t->fd = dup(atoi(address));
+    if (t->fd < 0)
+    {
+        perror(address);
+        return -1;
+    }
+    return 0;
+}
+
+static int socketClose(Transport *t)
+{
+    return close(t->fd);
+}
+
+static int socketReadable(Transport *t)
+{
+    int available;
+    if (ioctl(t->fd, FIONREAD, &available) == -1)
+    {
+        perror("FIONREAD");
+        return -1;
+    }
+    return available;
+}
+
+static int socketRead(Transport *t, char *bytes, int numBytes)
+{
+    return read(t->fd, bytes, numBytes);
+}
+
+static int socketWrite(Transport *t, const char *bytes, int numBytes)
+{
+    // MSG_NOSIGNAL: a closed peer is reported as an error, not SIGPIPE
+    return send(t->fd, bytes, numBytes, MSG_NOSIGNAL);
+}
+
+static int socketWait(Transport *t, int timeoutMs)
+{
+    struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready < 0)
+    {
+        perror("poll");
+        return -1;
+    }
+    if (ready > 0 && !(pfd.revents & POLLIN) && (pfd.revents & (POLLHUP | POLLERR)))
+    {
+        fprintf(stderr, "Serial port closed by the other side\n");
+        return -1;
+    }
+
+    return ready > 0;
+}
+
+const TransportOps socketTransport = {
+    .prefix = "socket:",
+    .open = socketOpen,
+    .close = socketClose,
+    .readable = socketReadable,
+    .read = socketRead,
+    .write = socketWrite,
+    .wait = socketWait,
+};
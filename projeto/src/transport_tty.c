@@ -0,0 +1,349 @@
+// Serial port (termios) transport backends: device paths and inherited
+// pseudo-terminal descriptors.
+
+#include "transport.h"
+
+#include <asm/ioctls.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// MISC
+#define _POSIX_SOURCE 1 // POSIX compliant source
+
+// Custom baud rates (Linux termios2 interface). <asm/termbits.h> cannot be
+// included together with <termios.h>, so the needed parts are repeated here.
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+#define KERNEL_NCCS 19
+#define MAX_BAUD_DEVIATION 50 // Accept drivers within 1/50 (2%) of the rate
+
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[KERNEL_NCCS];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+
+// Convert a baud rate to the corresponding termios flag.
+// Returns B0 if the baud rate is not supported.
+static tcflag_t baudRateFlag(int baudRate)
+{
+    switch (baudRate)
+    {
+        case 1200: return B1200;
+        case 1800: return B1800;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+// Check whether the port accepts arbitrary baud rates (termios2 / BOTHER).
+// Returns 1 if it does, 0 otherwise.
+static int ttyCustomBaudRate(Transport *t)
+{
+    struct termios2 tio;
+    return ioctl(t->fd, TCGETS2, &tio) == 0;
+}
+
+// Set an arbitrary baud rate through the termios2 interface (BOTHER),
+// optionally once all pending output has been transmitted.
+// Returns -1 on error or if the driver cannot generate the rate.
+static int setCustomBaudRate(Transport *t, int baudRate, int drain)
+{
+    struct termios2 tio;
+    if (ioctl(t->fd, TCGETS2, &tio) == -1)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+
+    tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = baudRate;
+    tio.c_ospeed = baudRate;
+
+    if (ioctl(t->fd, drain ? TCSETSW2 : TCSETS2, &tio) == -1)
+    {
+        perror("TCSETS2");
+        return -1;
+    }
+
+    // Drivers round to the closest rate they can generate
+    if (ioctl(t->fd, TCGETS2, &tio) == -1)
+    {
+        perror("TCGETS2");
+        return -1;
+    }
+    if (abs((int) tio.c_ospeed - baudRate) > baudRate / MAX_BAUD_DEVIATION)
+    {
+        fprintf(stderr, "Baud rate %d not supported by the driver (got %u)\n", baudRate, tio.c_ospeed);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Configure an open descriptor as a raw 8-N-1 port at "baudRate", saving the
+// previous settings to restore on close.
+// Returns -1 on error.
+static int configure(Transport *t, int baudRate)
+{
+    struct termios *oldtio = malloc(sizeof(struct termios));
+    if (oldtio == NULL)
+    {
+        perror("malloc");
+        return -1;
+    }
+    t->state = oldtio;
+
+    // Save current port settings
+    if (tcgetattr(t->fd, oldtio) == -1)
+    {
+        perror("tcgetattr");
+        return -1;
+    }
+
+    // Convert baud rate to appropriate flag
+    // (rates without one are set afterwards through termios2)
+    tcflag_t br = baudRateFlag(baudRate);
+    if (br == B0 && !ttyCustomBaudRate(t))
+    {
+        fprintf(stderr, "Unsupported baud rate (must be one of 1200, 1800, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600)\n");
+        return -1;
+    }
+
+    // New port settings
+    struct termios newtio;
+    memset(&newtio, 0, sizeof(newtio));
+
+    newtio.c_cflag = (br == B0 ? B38400 : br) | CS8 | CLOCAL | CREAD;
+    newtio.c_iflag = IGNPAR;
+    newtio.c_oflag = 0;
+
+    // Set input mode (non-canonical, no echo,...)
+    newtio.c_lflag = 0;
+    newtio.c_cc[VTIME] = 0; // Block reading
+    newtio.c_cc[VMIN] = 1;  // Byte by byte
+
+    tcflush(t->fd, TCIOFLUSH);
+
+    // Set new port settings
+    if (tcsetattr(t->fd, TCSANOW, &newtio) == -1)
+    {
+        perror("tcsetattr");
+        return -1;
+    }
+
+    if (br == B0 && setCustomBaudRate(t, baudRate, 0) == -1)
+    {
+        tcsetattr(t->fd, TCSANOW, oldtio);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ttyOpen(Transport *t, const char *address, int baudRate)
+{
+    // Open with O_NONBLOCK to avoid hanging when CLOCAL
+    // is not yet set on the serial port (changed later)
+    int oflags = O_RDWR | O_NOCTTY | O_NONBLOCK;
+    t->fd = open(address, oflags);
+    if (t->fd < 0)
+    {
+        perror(address);
+        return -1;
+    }
+
+    if (configure(t, baudRate) == -1)
+    {
+        close(t->fd);
+        free(t->state);
+        return -1;
+    }
+
+    // Clear O_NONBLOCK flag to ensure blocking reads
+    oflags ^= O_NONBLOCK;
+    if (fcntl(t->fd, F_SETFL, oflags) == -1)
+    {
+        perror("fcntl");
+        close(t->fd);
+        free(t->state);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ptyOpen(Transport *t, const char *address, int baudRate)
+{
+    // Use a private copy of the inherited descriptor
+    t->fd = dup(atoi(address));
+    if (t->fd < 0)
+    {
+        perror(address);
+        return -1;
+    }
+
+    if (configure(t, baudRate) == -1)
+    {
+        close(t->fd);
+        free(t->state);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Restore the old port settings and close the port.
+static int ttyClose(Transport *t)
+{
+    int res = 0;
+    if (tcsetattr(t->fd, TCSANOW, (struct termios *) t->state) == -1)
+    {
+        perror("tcsetattr");
+        res = -1;
+    }
+    free(t->state);
+
+    if (close(t->fd) == -1)
+    {
+        res = -1;
+    }
+    return res;
+}
+
+static int ttyReadable(Transport *t)
+{
+    int available;
+    if (ioctl(t->fd, FIONREAD, &available) == -1)
+    {
+        perror("FIONREAD");
+        return -1;
+    }
+    return available;
+}
+
+static int ttyRead(Transport *t, char *bytes, int numBytes)
+{
+    return read(t->fd, bytes, numBytes);
+}
+
+static int ttyWrite(Transport *t, const char *bytes, int numBytes)
+{
+    // The driver may be out of buffer space (e.g., flow control)
+    struct pollfd pfd = { .fd = t->fd, .events = POLLOUT };
+    if (poll(&pfd, 1, -1) == -1)
+    {
+        perror("poll");
+        return -1;
+    }
+
+    return write(t->fd, bytes, numBytes);
+}
+
+static int ttyWait(Transport *t, int timeoutMs)
+{
+    struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready < 0)
+    {
+        perror("poll");
+        return -1;
+    }
+    if (ready > 0 && !(pfd.revents & POLLIN) && (pfd.revents & (POLLHUP | POLLERR)))
+    {
+        fprintf(stderr, "Serial port closed by the other side\n");
+        return -1;
+    }
+
+    return ready > 0;
+}
+
+static int ttySetBaudRate(Transport *t, int baudRate)
+{
+    tcflag_t br = baudRateFlag(baudRate);
+    if (br == B0)
+    {
+        return setCustomBaudRate(t, baudRate, 1);
+    }
+
+    struct termios tio;
+    if (tcgetattr(t->fd, &tio) == -1)
+    {
+        perror("tcgetattr");
+        return -1;
+    }
+
+    cfsetispeed(&tio, br);
+    cfsetospeed(&tio, br);
+
+    if (tcsetattr(t->fd, TCSADRAIN, &tio) == -1)
+    {
+        perror("tcsetattr");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ttyOutputQueue(Transport *t)
+{
+    int queued;
+    if (ioctl(t->fd, TIOCOUTQ, &queued) == -1)
+    {
+        perror("TIOCOUTQ");
+        return -1;
+    }
+    return queued;
+}
+
+const TransportOps ttyTransport = {
+    .prefix = "",
+    .open = ttyOpen,
+    .close = ttyClose,
+    .readable = ttyReadable,
+    .read = ttyRead,
+    .write = ttyWrite,
+    .wait = ttyWait,
+    .setBaudRate = ttySetBaudRate,
+    .outputQueue = ttyOutputQueue,
+    .customBaudRate = ttyCustomBaudRate,
+};
+
+const TransportOps ptyTransport = {
+    .prefix = "pty:",
+    .open = ptyOpen,
+    .close = ttyClose,
+    .readable = ttyReadable,
+    .read = ttyRead,
+    .write = ttyWrite,
+    .wait = ttyWait,
+    .setBaudRate = ttySetBaudRate,
+    .outputQueue = ttyOutputQueue,
+    .customBaudRate = ttyCustomBaudRate,
+};
@@ -0,0 +1,91 @@
+// Virtual clock client (see virtual_clock.h)
+
+#include "virtual_clock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int clockFd = -1;         // Connection to the cable
+static int64_t virtualNow = 0;   // Time of the last wakeup (nsec)
+
+// Send a message and wait for the cable to answer with a wakeup.
+// Returns -1 on error.
+static int exchange(ClockMessage *msg)
+{
+    if (send(clockFd, msg, sizeof(*msg), MSG_NOSIGNAL) != sizeof(*msg) ||
+        recv(clockFd, msg, sizeof(*msg), MSG_WAITALL) != sizeof(*msg) ||
+        msg->type != CLOCK_WAKE)
+    {
+        fprintf(stderr, "Lost the connection to the virtual clock\n");
+        return -1;
+    }
+    virtualNow = msg->time;
+    return 0;
+}
+
+int clockAttach(const char *socketPath, const char *port)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    ClockMessage msg = { .type = CLOCK_HELLO };
+    if (strlen(socketPath) >= sizeof(addr.sun_path) || strlen(port) >= sizeof(msg.port))
+    {
+        fprintf(stderr, "Virtual clock socket or port name too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    strcpy(msg.port, port);
+
+    clockFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (clockFd < 0 || connect(clockFd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        perror(socketPath);
+        clockDetach();
+        return -1;
+    }
+
+    if (exchange(&msg) != 0)
+    {
+        clockDetach();
+        return -1;
+    }
+    return 0;
+}
+
+void clockDetach(void)
+{
+    if (clockFd >= 0)
+    {
+        close(clockFd);
+        clockFd = -1;
+    }
+}
+
+int clockAttached(void)
+{
+    return clockFd >= 0;
+}
+
+void clockTime(struct timespec *t)
+{
+    t->tv_sec = virtualNow / 1000000000;
+    t->tv_nsec = virtualNow % 1000000000;
+}
+
+int clockWait(int timeoutMs, int64_t written, int64_t read, int64_t *delivered)
+{
+    ClockMessage msg = {
+        .type = CLOCK_WAIT,
+        .time = timeoutMs < 0 ? -1 : virtualNow + timeoutMs * 1000000LL,
+        .written = written,
+        .read = read,
+    };
+    if (exchange(&msg) != 0)
+    {
+        return -1;
+    }
+    *delivered = msg.delivered;
+    return 0;
+}